@@ -0,0 +1,558 @@
+// Performance harness for the Terrains generators. Prints one JSON document
+// with a record per (benchmark, size, threads):
+//
+//   Benchmarks [--out FILE] [--sizes 512,1024,2048] [--threads 1,2,4]
+//              [--min-time SECONDS] [--filter TEXT] [--textures DIR]
+//              [--erosion-sizes 2048,8192]
+//
+// ns_per_sample is the best iteration divided by the samples it produces
+// (heights, vertices or decoded pixels); bytes_allocated counts operator new
+// in one iteration (lodepng's own malloc calls are not included); peak_rss is
+// the process high-water mark after the benchmark, so it only ever grows.
+// Iterative stages (erosion) also report iterations_per_second; a run
+// includes setting up the stage's buffers, so it understates the steady rate.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "noise.h"
+#include "fractalPresets.h"
+#include "grid.h"
+#include "loadTexture.h"
+#include "erosion.h"
+#include "noiseGraph.h"
+#include "normalMap.h"
+#include "cdlod.h"
+#include "rtin.h"
+#include "OpenGP/GL/Eigen.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+// Every allocation goes through here so each benchmark can report its bytes.
+// new is malloc and delete is free underneath; GCC cannot see that the two
+// are a pair once they are inlined, so -Wmismatched-new-delete is off for
+// these functions only.
+static std::atomic<size_t> allocatedBytes(0);
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wunknown-warning-option"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size) {
+    allocatedBytes += size;
+    void *p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+size_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (size_t) usage.ru_maxrss;
+#else
+    return (size_t) usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// evaluateGraph2D of fBmNode(perlinNode(seed, frequency), params) written out
+// by hand: the same octaves, shifts and arithmetic in one loop
+float* fBmHandWritten2D(const int width, const int height, const double frequency, const uint64_t seed,
+                        const FractalParams &params) {
+    const PerlinNode perlin = { seed, frequency };
+    const std::vector<float> exponents = fractalExponents(params);
+    const double du = 1.0 / width, dv = 1.0 / height;
+
+    return fractal2D(width, height, [&](int j, float *row, FractalScratch &) {
+        for (int i = 0; i < width; ++i) {
+            double x = i * du, y = j * dv;
+            float noise = 0.0f;
+            double f = 1.0;
+            for (int k = 0; k < params.octaves; ++k) {
+                double shift = k * octaveShift;
+                noise += (perlin(x * f + shift, y * f + shift) + params.offset) * exponents[k];
+                f *= params.lacunarity;
+            }
+            row[i] = noise;
+        }
+    });
+}
+
+// alpineGraph2D written out by hand: the same samples and arithmetic in one
+// loop, the baseline the noise graph's overhead is measured against
+float* alpineHandWritten2D(const int width, const int height, const int period, const uint64_t seed,
+                           const FractalParams &params) {
+    const double frequency = (double) width / period;
+    const PerlinNode hills = { seed, frequency };
+    const PerlinNode peaks = { mix64(seed + 1), frequency };
+    const SimplexField mask(mix64(seed + 2)), warpX(mix64(seed + 3)), warpY(mix64(seed + 4));
+    const std::vector<float> exponents = fractalExponents(params);
+    FractalParams ridgeParams = params;
+    ridgeParams.octaves = params.octaves + 1;
+    const std::vector<float> ridgeExponents = fractalExponents(ridgeParams);
+    const float amount = 0.25f * period / width;
+    const double du = 1.0 / width, dv = 1.0 / height;
+
+    return fractal2D(width, height, [&](int j, float *row, FractalScratch &) {
+        for (int i = 0; i < width; ++i) {
+            double x = i * du, y = j * dv;
+            float dx = warpX.sample(x * 2 * frequency, y * 2 * frequency);
+            float dy = warpY.sample(x * 2 * frequency, y * 2 * frequency);
+            float t = mask.sample((x + amount * dx) * 0.5 * frequency, (y + amount * dy) * 0.5 * frequency);
+            t = cubicFade(std::min(std::max((t + 0.15f) / 0.3f, 0.0f), 1.0f));
+
+            float a = 0.0f, b = 0.0f;
+            double f = 1.0;
+            if (t < 1.0f) {
+                for (int k = 0; k < params.octaves; ++k, f *= params.lacunarity) {
+                    double shift = k * octaveShift;
+                    a += (hills(x * f + shift, y * f + shift) + params.offset) * exponents[k];
+                }
+            }
+            f = 1.0;
+            if (t > 0.0f) {
+                for (int k = 0; k < ridgeParams.octaves; ++k, f *= params.lacunarity) {
+                    double shift = k * octaveShift;
+                    b += peaks(x * f + shift, y * f + shift) * ridgeExponents[k];
+                }
+                b = (1.0f - std::abs(b)) * 1.2f - 0.2f;
+            }
+            row[i] = lerp(a, b, t);
+        }
+    });
+}
+
+struct BenchmarkResult {
+    std::string name;
+    int size;
+    int threads;
+    int iterations;
+    double samples;
+    int stageIterations;    // iterations of an iterative stage per run, or 0
+    double bestNs;
+    double medianNs;
+    size_t bytesAllocated;
+    size_t peakRss;
+};
+
+struct BenchmarkOptions {
+    std::vector<int> sizes;
+    std::vector<int> threads;
+    std::vector<int> erosionSizes;
+    double minTime = 0.5;
+    std::string filter;
+    std::string textureDir;
+};
+
+// Runs fn once to warm up, then until minTime has passed (3 to 100 iterations)
+template <typename Fn>
+BenchmarkResult runBenchmark(const BenchmarkOptions &options, const std::string &name, int size, int threads,
+                             double samples, Fn fn) {
+    fn();
+
+    std::vector<double> times;
+    size_t bytes = 0;
+    double total = 0.0;
+    while (times.size() < 3 || (total < options.minTime * 1e9 && times.size() < 100)) {
+        size_t before = allocatedBytes;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        fn();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (times.empty()) bytes = allocatedBytes - before;
+        times.push_back(ns);
+        total += ns;
+    }
+    std::sort(times.begin(), times.end());
+
+    BenchmarkResult r;
+    r.name = name;
+    r.size = size;
+    r.threads = threads;
+    r.iterations = (int) times.size();
+    r.samples = samples;
+    r.stageIterations = 0;
+    r.bestNs = times.front();
+    r.medianNs = times[times.size() / 2];
+    r.bytesAllocated = bytes;
+    r.peakRss = peakResidentBytes();
+
+    std::cerr << name << " size " << size << " threads " << threads << ": "
+              << r.bestNs / samples << " ns/sample" << std::endl;
+    return r;
+}
+
+std::vector<int> parseList(const std::string &text) {
+    std::vector<int> values;
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+}
+
+void writeJson(std::ostream &out, const std::vector<BenchmarkResult> &results) {
+    out << "{\n";
+    out << "  \"simd\": \"" << simdLevelName(perlinSimdSetting()) << "\",\n";
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"benchmarks\": [\n";
+    for (size_t k = 0; k < results.size(); ++k) {
+        const BenchmarkResult &r = results[k];
+        out << "    {\"name\": \"" << r.name << "\", \"size\": " << r.size << ", \"threads\": " << r.threads
+            << ", \"iterations\": " << r.iterations << ", \"samples\": " << (long long) r.samples
+            << ", \"ns_per_sample\": " << r.bestNs / r.samples
+            << ", \"median_ns_per_sample\": " << r.medianNs / r.samples
+            << ", \"best_ms\": " << r.bestNs * 1e-6;
+        if (r.stageIterations > 0) {
+            out << ", \"iterations_per_second\": " << r.stageIterations / (r.bestNs * 1e-9);
+        }
+        out
+            << ", \"bytes_allocated\": " << r.bytesAllocated
+            << ", \"peak_rss\": " << r.peakRss << "}" << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    options.sizes = parseList("512,1024,2048");
+    options.threads = parseList("1,2,4");
+    options.erosionSizes = parseList("2048,8192");
+    int hardware = (int) std::thread::hardware_concurrency();
+    if (hardware > 4) options.threads.push_back(hardware);
+#ifdef BENCHMARK_TEXTURE_DIR
+    options.textureDir = BENCHMARK_TEXTURE_DIR;
+#else
+    options.textureDir = ".";
+#endif
+    std::string outPath;
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        if (arg == "--out" && a + 1 < argc) {
+            outPath = argv[++a];
+        } else if (arg == "--sizes" && a + 1 < argc) {
+            options.sizes = parseList(argv[++a]);
+        } else if (arg == "--threads" && a + 1 < argc) {
+            options.threads = parseList(argv[++a]);
+        } else if (arg == "--min-time" && a + 1 < argc) {
+            options.minTime = std::atof(argv[++a]);
+        } else if (arg == "--filter" && a + 1 < argc) {
+            options.filter = argv[++a];
+        } else if (arg == "--textures" && a + 1 < argc) {
+            options.textureDir = argv[++a];
+        } else if (arg == "--erosion-sizes" && a + 1 < argc) {
+            options.erosionSizes = parseList(argv[++a]);
+        }
+    }
+
+    std::vector<BenchmarkResult> results;
+    auto enabled = [&](const std::string &name) {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    };
+
+    // Heightmap generators, across sizes and worker threads. The fractal
+    // runs are the generators behind fBm2DTexture and
+    // HybridMultifractal2DTexture (period = size / 4, summer parameters);
+    // the texture upload needs a GL context and is not timed. The :simplex
+    // runs are the same generators on the simplex basis.
+    FractalParams summer;
+    summer.H = 0.9f;
+    summer.lacunarity = 2.0f;
+    summer.offset = 0.1f;
+    summer.octaves = 5;
+
+    for (size_t s = 0; s < options.sizes.size(); ++s) {
+        int size = options.sizes[s];
+        double samples = (double) size * size;
+        for (size_t t = 0; t < options.threads.size(); ++t) {
+            int threads = options.threads[t];
+            setNoiseThreads(threads);
+
+            if (enabled("perlin2D")) {
+                results.push_back(runBenchmark(options, "perlin2D", size, threads, samples, [&]() {
+                    delete[] perlin2D(size, size);
+                }));
+            }
+            if (enabled("simplex2D")) {
+                results.push_back(runBenchmark(options, "simplex2D", size, threads, samples, [&]() {
+                    delete[] simplex2D(size, size);
+                }));
+            }
+            if (enabled("fBm2D")) {
+                results.push_back(runBenchmark(options, "fBm2D", size, threads, samples, [&]() {
+                    delete[] fBm2D(size, size, size / 4, defaultNoiseSeed, summer);
+                }));
+            }
+            if (enabled("fBm2D:simplex")) {
+                results.push_back(runBenchmark(options, "fBm2D:simplex", size, threads, samples, [&]() {
+                    delete[] fBm2D(size, size, size / 4, defaultNoiseSeed, summer, NoiseBasis::Simplex);
+                }));
+            }
+            if (enabled("HybridMultifractal2D")) {
+                results.push_back(runBenchmark(options, "HybridMultifractal2D", size, threads, samples, [&]() {
+                    delete[] HybridMultifractal2D(size, size, size / 4, defaultNoiseSeed, summer);
+                }));
+            }
+            if (enabled("HybridMultifractal2D:simplex")) {
+                results.push_back(runBenchmark(options, "HybridMultifractal2D:simplex", size, threads, samples, [&]() {
+                    delete[] HybridMultifractal2D(size, size, size / 4, defaultNoiseSeed, summer, NoiseBasis::Simplex);
+                }));
+            }
+        }
+    }
+
+    // Normal maps of the summer preset: Sobel over the heights and analytic
+    // noise derivatives (period = size / 4)
+    if (enabled("normalMap")) {
+        const FractalPreset &preset = *findFractalPreset("summer");
+        for (size_t s = 0; s < options.sizes.size(); ++s) {
+            int size = options.sizes[s];
+            double samples = (double) size * size;
+            float *heights = preset.generate2D(size, size, size / 4, defaultNoiseSeed);
+            for (size_t t = 0; t < options.threads.size(); ++t) {
+                int threads = options.threads[t];
+                setNoiseThreads(threads);
+                if (enabled("normalMap:sobel")) {
+                    results.push_back(runBenchmark(options, "normalMap:sobel", size, threads, samples, [&]() {
+                        sobelNormalMap(heights, size, size);
+                    }));
+                }
+                if (enabled("normalMap:analytic")) {
+                    results.push_back(runBenchmark(options, "normalMap:analytic", size, threads, samples, [&]() {
+                        analyticNormalMap(preset, preset.params, defaultNoiseSeed, size, size, size / 4);
+                    }));
+                }
+            }
+            delete[] heights;
+        }
+    }
+
+    // Noise graphs against the same computation written as one loop
+    // (noiseGraph:X vs handWritten:X); the ratio is the cost of composing nodes
+    if (enabled("noiseGraph") || enabled("handWritten")) {
+        for (size_t s = 0; s < options.sizes.size(); ++s) {
+            int size = options.sizes[s];
+            double samples = (double) size * size;
+            for (size_t t = 0; t < options.threads.size(); ++t) {
+                int threads = options.threads[t];
+                setNoiseThreads(threads);
+
+                if (enabled("noiseGraph:fBm")) {
+                    results.push_back(runBenchmark(options, "noiseGraph:fBm", size, threads, samples, [&]() {
+                        delete[] evaluateGraph2D(size, size, fBmNode(perlinNode(defaultNoiseSeed, 4.0), summer));
+                    }));
+                }
+                if (enabled("handWritten:fBm")) {
+                    results.push_back(runBenchmark(options, "handWritten:fBm", size, threads, samples, [&]() {
+                        delete[] fBmHandWritten2D(size, size, 4.0, defaultNoiseSeed, summer);
+                    }));
+                }
+                if (enabled("noiseGraph:alpine")) {
+                    results.push_back(runBenchmark(options, "noiseGraph:alpine", size, threads, samples, [&]() {
+                        delete[] alpineGraph2D(size, size, size / 4, defaultNoiseSeed, summer);
+                    }));
+                }
+                if (enabled("handWritten:alpine")) {
+                    results.push_back(runBenchmark(options, "handWritten:alpine", size, threads, samples, [&]() {
+                        delete[] alpineHandWritten2D(size, size, size / 4, defaultNoiseSeed, summer);
+                    }));
+                }
+            }
+        }
+    }
+
+    // Erosion on an fBm map, across sizes and worker threads. A run is a few
+    // iterations on a fresh copy (cell size of the 5x5 patch at that resolution).
+    if (enabled("erosionHydraulic") || enabled("erosionThermal")) {
+        for (size_t s = 0; s < options.erosionSizes.size(); ++s) {
+            int size = options.erosionSizes[s];
+            float *generated = fBm2D(size, size, size / 4, defaultNoiseSeed, summer);
+            std::vector<float> input(generated, generated + (size_t) size * size);
+            delete[] generated;
+            float cellSize = 5.0f / size / 0.6f;
+
+            ErosionParams hydraulic;
+            hydraulic.hydraulicIterations = size > 4096 ? 2 : 10;
+            ErosionParams thermal;
+            thermal.thermalIterations = size > 4096 ? 4 : 20;
+            const ErosionParams *stages[2] = { &hydraulic, &thermal };
+            const char *names[2] = { "erosionHydraulic", "erosionThermal" };
+
+            for (int stage = 0; stage < 2; ++stage) {
+                if (!enabled(names[stage])) continue;
+                const ErosionParams &params = *stages[stage];
+                int iterations = params.hydraulicIterations + params.thermalIterations;
+                for (size_t t = 0; t < options.threads.size(); ++t) {
+                    int threads = options.threads[t];
+                    setNoiseThreads(threads);
+                    BenchmarkResult r = runBenchmark(options, names[stage], size, threads,
+                                                     (double) size * size * iterations, [&]() {
+                        std::vector<float> heights(input);
+                        erodeHeightmap(heights.data(), size, size, cellSize, params);
+                    });
+                    r.stageIterations = iterations;
+                    results.push_back(r);
+                }
+            }
+        }
+    }
+
+    // Grid generation as in genTerrainMesh (the app uses n = 1024), across
+    // worker threads: the full vertex format, and the strip indices alone
+    // (all the attribute-less format needs) up to 8192^2
+    if (enabled("generateGrid")) {
+        const int gridSizes[] = { 1024, 2048, 4096, 8192 };
+        for (int g = 0; g < 4; ++g) {
+            int n = gridSizes[g];
+            for (size_t t = 0; t < options.threads.size(); ++t) {
+                int threads = options.threads[t];
+                WorkerPool pool(threads);
+                if (n <= 4096 && enabled("generateGrid:full")) {
+                    results.push_back(runBenchmark(options, "generateGrid:full", n, threads, (double) n * n, [&]() {
+                        GridMesh grid;
+                        generateGrid(n, 5.0f, 0.0f, 0xFFFFFFFFu, grid, &pool);
+                    }));
+                }
+                if (enabled("generateGrid:indices")) {
+                    results.push_back(runBenchmark(options, "generateGrid:indices", n, threads, (double) n * n, [&]() {
+                        std::vector<unsigned int> indices;
+                        generateGridIndices(n, 0xFFFFFFFFu, indices, &pool);
+                    }));
+                }
+            }
+        }
+    }
+
+    // CDLOD selection on the summer preset at each size (the 5x5 patch): 64
+    // cameras on a circle round the centre, looking at it. A sample is one
+    // selection.
+    if (enabled("cdlodSelect")) {
+        const FractalPreset &preset = *findFractalPreset("summer");
+        const Mat4x4 P = perspective(80.0f, 1280 / 720.0f, 0.1f, 60.0f);
+        const int cameras = 64;
+        for (size_t s = 0; s < options.sizes.size(); ++s) {
+            int size = options.sizes[s];
+            float *heights = preset.generate2D(size, size, size / 4, defaultNoiseSeed);
+            HeightPyramid pyramid(heights, size, size, -2.5f, -2.5f, 5.0f / size);
+            delete[] heights;
+            CDLODQuadtree tree(pyramid);
+
+            std::vector<Vec3> positions;
+            std::vector<Frustum> frusta;
+            for (int c = 0; c < cameras; ++c) {
+                float angle = 2.0f * (float) M_PI * c / cameras;
+                Vec3 eye(2.0f * std::cos(angle), 2.0f * std::sin(angle), 1.2f);
+                positions.push_back(eye);
+                frusta.push_back(viewFrustum(P * lookAt(eye, Vec3(0.0f, 0.0f, 0.6f), Vec3(0.0f, 0.0f, 1.0f))));
+            }
+
+            std::vector<CDLODNode> nodes;
+            results.push_back(runBenchmark(options, "cdlodSelect", size, 1, cameras, [&]() {
+                for (int c = 0; c < cameras; ++c) {
+                    tree.select(positions[c], frusta[c], nodes);
+                }
+            }));
+        }
+    }
+
+    // Adaptive triangulation of the summer preset at each size and thread
+    // count: the error pass (rtinErrors), and the mesh within 0.002 world
+    // units (rtinMesh). A sample is one heightmap sample.
+    if (enabled("rtin")) {
+        const FractalPreset &preset = *findFractalPreset("summer");
+        for (size_t s = 0; s < options.sizes.size(); ++s) {
+            int size = options.sizes[s];
+            float *heights = preset.generate2D(size, size, size / 4, defaultNoiseSeed);
+            HeightPyramid pyramid(heights, size, size, -2.5f, -2.5f, 5.0f / size);
+            delete[] heights;
+            for (size_t t = 0; t < options.threads.size(); ++t) {
+                int threads = options.threads[t];
+                setNoiseThreads(threads);
+                if (enabled("rtinErrors")) {
+                    results.push_back(runBenchmark(options, "rtinErrors", size, threads, (double) size * size, [&]() {
+                        RTINTerrain terrain(pyramid, noisePool());
+                    }));
+                }
+                if (enabled("rtinMesh")) {
+                    RTINTerrain terrain(pyramid, noisePool());
+                    results.push_back(runBenchmark(options, "rtinMesh", size, threads, (double) size * size, [&]() {
+                        terrain.triangulate(0.002f);
+                    }));
+                }
+            }
+        }
+    }
+
+    // PNG decoding with loadTexture (the 1024^2 skybox faces and the terrain textures)
+    if (enabled("loadTexture")) {
+        const std::string names[] = { "grass", "rock", "miramar_ft" };
+        for (int k = 0; k < 3; ++k) {
+            std::string path = options.textureDir + "/" + names[k] + ".png";
+            std::vector<unsigned char> image;
+            loadTexture(image, path.c_str());
+            if (image.empty()) continue;
+            double pixels = image.size() / 4.0;
+            int side = (int) std::sqrt(pixels);
+            results.push_back(runBenchmark(options, "loadTexture:" + names[k], side, 1, pixels, [&]() {
+                std::vector<unsigned char> decoded;
+                loadTexture(decoded, path.c_str());
+            }));
+        }
+    }
+
+    if (outPath.empty()) {
+        writeJson(std::cout, results);
+    } else {
+        std::ofstream out(outPath.c_str());
+        writeJson(out, results);
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <OpenGP/GL/Application.h>
+#include "grid.h"
+#include "heightPyramid.h"
+
+// Continuous distance-dependent LOD (Strugar, "Continuous Distance-Dependent
+// Level of Detail for Rendering Heightmaps") over the fixed map. The quadtree
+// is the HeightPyramid from its leafCells x leafCells nodes up, so every node
+// already has its height bounds. All nodes are drawn with one grid of
+// gridDim x gridDim quads; a node of LOD level L has its vertices twice as
+// far apart as one of level L - 1.
+//
+// Selection runs on the CPU only: it walks the tree from the root, drops
+// nodes outside the view frustum and gives each part of the map the finest
+// level whose range reaches the camera. The vertex shader morphs vertices
+// onto the next coarser level's grid over the outer part of their level's
+// range, so a node switching level does not pop.
+//
+// Coordinates are heightmap samples (i, j) as in HeightPyramid: sample
+// (i, j) lies at world x = x0 + j * cellSize, y = y0 + i * cellSize.
+
+// The six planes a x + b y + c z + d >= 0 bounding what a clip matrix
+// (P * V) shows (Gribb and Hartmann)
+struct Frustum {
+    float planes[6][4];
+
+    // False only if the box lies entirely outside one of the planes
+    bool intersects(const Vec3 &lo, const Vec3 &hi) const {
+        for (int p = 0; p < 6; ++p) {
+            const float *plane = planes[p];
+            float x = plane[0] >= 0 ? hi[0] : lo[0];
+            float y = plane[1] >= 0 ? hi[1] : lo[1];
+            float z = plane[2] >= 0 ? hi[2] : lo[2];
+            if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0) return false;
+        }
+        return true;
+    }
+};
+
+inline Frustum viewFrustum(const Mat4x4 &clip) {
+    Frustum frustum;
+    for (int p = 0; p < 6; ++p) {
+        int row = p / 2;
+        float sign = p % 2 == 0 ? 1.0f : -1.0f;
+        for (int k = 0; k < 4; ++k) {
+            frustum.planes[p][k] = clip(3, k) + sign * clip(row, k);
+        }
+    }
+    return frustum;
+}
+
+struct CDLODSettings {
+    int leafCells = 32;         // heightmap cells on a side of the finest nodes
+    int gridDim = 32;           // quads on a side of a node's grid
+    float pixelError = 2.0f;    // on-screen size of a level's vertex spacing at the end of its range
+    float fovY = 80.0f;         // degrees, as passed to perspective()
+    int viewportHeight = 720;   // pixels
+    float morphStart = 0.7f;    // part of a level's band after which it morphs to the next
+};
+
+// One node to draw: a square of the map at a LOD level. A node whose parent
+// was selected but which is itself out of its level's range is drawn at the
+// parent's level, with half the grid.
+struct CDLODNode {
+    int level;          // LOD level, 0 the finest
+    int i, j;           // heightmap sample of the corner
+    int cells;          // heightmap cells on a side
+    float lo, hi;       // world height bounds
+};
+
+class CDLODQuadtree {
+public:
+
+    // leafCells and gridDim powers of two, gridDim at least 4
+    CDLODQuadtree(const HeightPyramid &terrain, const CDLODSettings &settings = CDLODSettings())
+        : terrain(terrain), settings(settings), leafLevel(0) {
+        assert((settings.leafCells & (settings.leafCells - 1)) == 0);
+        assert((settings.gridDim & (settings.gridDim - 1)) == 0 && settings.gridDim >= 4);
+        while ((1 << leafLevel) < settings.leafCells) ++leafLevel;
+        assert(terrain.levels() > leafLevel);
+        levels = terrain.levels() - leafLevel;
+
+        // A grid of spacing s at distance d covers s * focal / d pixels. Level 0
+        // reaches as far as its spacing stays above pixelError, and at least
+        // twice a leaf so the morph band is wider than a node; each coarser
+        // level reaches twice as far. The root covers whatever is left.
+        const float focal = settings.viewportHeight / (2.0f * std::tan(settings.fovY * (float) M_PI / 360.0f));
+        const float leafSize = settings.leafCells * terrain.cellSize;
+        const float spacing = leafSize / settings.gridDim;
+        float range = std::max(spacing * focal / settings.pixelError, 2.0f * std::sqrt(2.0f) * leafSize);
+        float previous = 0.0f;
+        for (int l = 0; l < levels; ++l) {
+            if (l == levels - 1) range = std::numeric_limits<float>::max();
+            ranges.push_back(range);
+            morphStarts.push_back(previous + (range - previous) * settings.morphStart);
+            previous = range;
+            range *= 2.0f;
+        }
+    }
+
+    // Nodes to draw for a camera at world position camera seeing frustum,
+    // appended to nodes (cleared first). No GL calls.
+    void select(const Vec3 &camera, const Frustum &frustum, std::vector<CDLODNode> &nodes) const {
+        nodes.clear();
+        const int top = leafLevel + levels - 1;
+        for (int b = 0; b < terrain.nodesJ(top); ++b) {
+            for (int a = 0; a < terrain.nodesI(top); ++a) {
+                selectNode(levels - 1, a, b, camera, frustum, nodes);
+            }
+        }
+    }
+
+    std::vector<CDLODNode> select(const Vec3 &camera, const Frustum &frustum) const {
+        std::vector<CDLODNode> nodes;
+        select(camera, frustum, nodes);
+        return nodes;
+    }
+
+    int levelCount() const { return levels; }
+
+    // Distance from the camera up to which level l is drawn, and where it
+    // starts morphing towards level l + 1 (the largest float for the root)
+    float range(const int l) const { return ranges[l]; }
+    float morphStart(const int l) const { return morphStarts[l]; }
+
+    // Heightmap samples between the vertices of level l
+    int spacing(const int l) const { return (settings.leafCells << l) / settings.gridDim; }
+
+    int gridDim() const { return settings.gridDim; }
+    const HeightPyramid &heights() const { return terrain; }
+
+private:
+
+    // World box of pyramid node (a, b) on level p
+    void nodeBox(const int p, const int a, const int b, Vec3 &lo, Vec3 &hi) const {
+        int i0 = a << p, j0 = b << p;
+        int i1 = std::min((a + 1) << p, terrain.width - 1), j1 = std::min((b + 1) << p, terrain.height - 1);
+        terrain.nodeBounds(p, a, b, lo[2], hi[2]);
+        lo[0] = terrain.x0 + j0 * terrain.cellSize;
+        hi[0] = terrain.x0 + j1 * terrain.cellSize;
+        lo[1] = terrain.y0 + i0 * terrain.cellSize;
+        hi[1] = terrain.y0 + i1 * terrain.cellSize;
+    }
+
+    static bool withinRange(const Vec3 &camera, const float range, const Vec3 &lo, const Vec3 &hi) {
+        float d2 = 0.0f;
+        for (int k = 0; k < 3; ++k) {
+            float d = std::max(std::max(lo[k] - camera[k], camera[k] - hi[k]), 0.0f);
+            d2 += d * d;
+        }
+        return d2 <= range * range;
+    }
+
+    void add(const int level, const int p, const int a, const int b, std::vector<CDLODNode> &nodes) const {
+        CDLODNode node;
+        node.level = level;
+        node.i = a << p;
+        node.j = b << p;
+        node.cells = 1 << p;
+        terrain.nodeBounds(p, a, b, node.lo, node.hi);
+        nodes.push_back(node);
+    }
+
+    // LOD level `level`, pyramid node (a, b). False if the node is beyond its
+    // level's range, so the parent has to draw it; true if it was drawn or
+    // is out of view.
+    bool selectNode(const int level, const int a, const int b, const Vec3 &camera,
+                    const Frustum &frustum, std::vector<CDLODNode> &nodes) const {
+        const int p = leafLevel + level;
+        Vec3 lo, hi;
+        nodeBox(p, a, b, lo, hi);
+        if (!withinRange(camera, ranges[level], lo, hi)) return false;
+        if (!frustum.intersects(lo, hi)) return true;
+
+        if (level == 0 || !withinRange(camera, ranges[level - 1], lo, hi)) {
+            add(level, p, a, b, nodes);
+            return true;
+        }
+
+        // Children the finer level does not reach are drawn at this level
+        for (int c = 0; c < 4; ++c) {
+            int ca = 2 * a + (c & 1), cb = 2 * b + (c >> 1);
+            if (ca >= terrain.nodesI(p - 1) || cb >= terrain.nodesJ(p - 1)) continue;
+            if (selectNode(level - 1, ca, cb, camera, frustum, nodes)) continue;
+            nodeBox(p - 1, ca, cb, lo, hi);
+            if (frustum.intersects(lo, hi)) add(level, p - 1, ca, cb, nodes);
+        }
+        return true;
+    }
+
+    const HeightPyramid &terrain;
+    const CDLODSettings settings;
+    int leafLevel;      // pyramid level of the leaves
+    int levels;
+    std::vector<float> ranges;
+    std::vector<float> morphStarts;
+};
+
+// Draws a selection with a shader built from cdlod_vshader: one
+// attribute-less grid patch for whole nodes and one for half nodes
+class CDLODRenderer {
+public:
+
+    CDLODRenderer(const CDLODQuadtree &tree, const unsigned int restart)
+        : tree(tree), restart(restart) {
+        full = patchIndexMesh(tree.gridDim() + 1, tree.gridDim() + 1, restart);
+        half = patchIndexMesh(tree.gridDim() / 2 + 1, tree.gridDim() / 2 + 1, restart);
+    }
+
+    CDLODRenderer(const CDLODRenderer&) = delete;
+    CDLODRenderer &operator=(const CDLODRenderer&) = delete;
+
+    void draw(Shader &shader, const std::vector<CDLODNode> &nodes) {
+        const HeightPyramid &terrain = tree.heights();
+        shader.set_uniform("mapLayout", Vec3(terrain.x0, terrain.y0, terrain.cellSize));
+        shader.set_uniform("mapWidth", terrain.width);
+        shader.set_uniform("mapHeight", terrain.height);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(restart);
+
+        triangles = 0;
+        for (size_t k = 0; k < nodes.size(); ++k) {
+            const CDLODNode &node = nodes[k];
+            const int spacing = tree.spacing(node.level);
+            const int quads = node.cells / spacing;
+            const float start = tree.morphStart(node.level), end = tree.range(node.level);
+            const float scale = end > start && end < std::numeric_limits<float>::max() ? 1.0f / (end - start) : 0.0f;
+
+            shader.set_uniform("nodeOrigin", Vec3((float) node.i, (float) node.j, (float) spacing));
+            shader.set_uniform("nodeVertices", quads + 1);
+            shader.set_uniform("morphRange", Vec3(start, scale, 0.0f));
+            (quads == tree.gridDim() ? full : half)->draw();
+            triangles += 2 * (size_t) quads * quads;
+        }
+    }
+
+    // Triangles in the last draw
+    size_t trianglesDrawn() const { return triangles; }
+
+private:
+    const CDLODQuadtree &tree;
+    const unsigned int restart;
+    std::unique_ptr<GPUMesh> full, half;
+    size_t triangles = 0;
+};
@@ -0,0 +1,64 @@
+R"(
+#version 330 core
+
+// One node of a CDLOD selection (CDLODRenderer in cdlod.h). The vertex is
+// gl_VertexID on a patch of nodeVertices per row; heights come from the
+// heightmap like terrain_vshader's.
+uniform sampler2D noiseTex;
+// Heights are stored quantised: h = texel * heightScale + heightOffset
+uniform float heightScale;
+uniform float heightOffset;
+
+// Heightmap sample (i, j) of the node's corner, and samples between vertices
+uniform vec3 nodeOrigin;
+uniform int nodeVertices;
+// Camera distance where the node's level starts morphing to the next coarser
+// one, and 1 / the length of the morph (0: never morphs)
+uniform vec3 morphRange;
+uniform vec3 viewPos;
+
+// Sample (i, j) lies at world (mapLayout.x + j * mapLayout.z, mapLayout.y + i * mapLayout.z)
+uniform vec3 mapLayout;
+uniform int mapWidth;
+uniform int mapHeight;
+
+uniform mat4 M;
+uniform mat4 V;
+uniform mat4 P;
+
+out vec2 uv;
+out vec2 heightUV;
+out vec3 fragPos;
+
+out float waterHeight;
+
+// World position of heightmap sample (i, j), folded onto the map at its edge
+vec3 terrainPoint(vec2 texel) {
+    texel = clamp(texel, vec2(0.0), vec2(mapWidth - 1, mapHeight - 1));
+    vec2 st = (texel + 0.5) / vec2(mapWidth, mapHeight);
+    float h = (texture(noiseTex, st).r * heightScale + heightOffset + 1.0f) * 0.6;
+    return vec3(mapLayout.x + texel.y * mapLayout.z, mapLayout.y + texel.x * mapLayout.z, h);
+}
+
+void main() {
+
+    vec2 local = vec2(gl_VertexID % nodeVertices, gl_VertexID / nodeVertices);
+
+    // Odd vertices slide onto their even neighbour as the camera moves away,
+    // so at the end of the range the node is the coarser level's grid
+    float d = distance(terrainPoint(nodeOrigin.xy + local * nodeOrigin.z), viewPos);
+    float alpha = clamp((d - morphRange.x) * morphRange.y, 0.0, 1.0);
+    local -= mod(local, 2.0) * alpha;
+
+    vec2 texel = clamp(nodeOrigin.xy + local * nodeOrigin.z, vec2(0.0), vec2(mapWidth - 1, mapHeight - 1));
+    uv = (texel + 0.5) / vec2(mapWidth, mapHeight);
+    heightUV = uv;
+
+    fragPos = terrainPoint(texel);
+
+    gl_Position = P*V*M*vec4(fragPos, 1.0f);
+
+    // Earth scene
+    waterHeight = 0.53f;
+}
+)"
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <OpenGP/GL/Application.h>
+#include "grid.h"
+#include "heightPyramid.h"
+#include "parallel.h"
+
+// Geometry clipmap renderer for the fixed map (Losasso and Hoppe, with the
+// block layout of GPU Gems 2, chapter 2). Level l is a grid of n = 4m - 1
+// vertices spaced 2^l heightmap samples apart, centred on the camera; each
+// level fills the ring around the next finer one, so the triangle count is
+// the same wherever the camera is and grows with the log of the map size.
+//
+// A level's heights live in a toroidal texture of the level's samples: when
+// the camera moves only the rows and columns that came into view are
+// uploaded. Each texel holds the level's own height and the next coarser
+// level's height at the same point; the vertex shader blends towards the
+// coarse one near the level's outer edge, so levels meet without cracks.
+//
+// Construction only downsamples the levels; the textures and patch meshes
+// are created by the first update, so a clipmap can be built on a thread
+// without a GL context and handed to the render thread.
+//
+// Coordinates are heightmap samples (i, j) as in HeightPyramid: sample
+// (i, j) lies at world x = x0 + j * cellSize, y = y0 + i * cellSize.
+
+using RG32FTexture = Texture<GL_RG32F, GL_RG, GL_FLOAT>;
+
+class GeometryClipmap {
+public:
+
+    // blockSize m, a power of two: levels are 4m - 1 vertices on a side.
+    // Downsampling runs on pool.
+    GeometryClipmap(const HeightPyramid &terrain, const unsigned int restart, WorkerPool &pool, const int blockSize = 32)
+        : m(blockSize), n(4 * blockSize - 1), textureSize(4 * blockSize), restart(restart),
+          mapWidth(terrain.width), mapHeight(terrain.height),
+          x0(terrain.x0), y0(terrain.y0), cellSize(terrain.cellSize) {
+        assert((blockSize & (blockSize - 1)) == 0);
+
+        // Enough levels for the coarsest to reach the far side of the map
+        // from anywhere on it
+        levels.push_back(Level());
+        levels[0].size[0] = mapWidth;
+        levels[0].size[1] = mapHeight;
+        levels[0].heights.assign(terrain.worldHeights(), terrain.worldHeights() + (size_t) mapWidth * mapHeight);
+        while ((2 * m - 1) * levels.back().spacing < std::max(mapWidth, mapHeight) &&
+               std::min(levels.back().size[0], levels.back().size[1]) > 2) {
+            levels.push_back(Level());
+            downsample(levels[levels.size() - 2], levels.back(), pool);
+        }
+
+        std::cout << "Clipmap: " << levels.size() << " levels of " << n << "^2 vertices, "
+                  << (levels.size() * textureSize * textureSize * 8 >> 10) << " KB of level textures" << std::endl;
+    }
+
+    GeometryClipmap(const GeometryClipmap&) = delete;
+    GeometryClipmap &operator=(const GeometryClipmap&) = delete;
+
+    // Recentres the levels on world (x, y) and uploads what came into view
+    void update(const float x, const float y) {
+        createGL();
+        const int ci = (int) std::floor((y - y0) / cellSize);
+        const int cj = (int) std::floor((x - x0) / cellSize);
+
+        // Level 0 on even samples; each coarser level sits m - 1 or m of its
+        // vertices outside the finer one, on a multiple of its own spacing
+        // times two so that its vertices are those of the level above
+        int origin[2] = { floorDiv(ci - (2 * m - 1), 2) * 2, floorDiv(cj - (2 * m - 1), 2) * 2 };
+        for (size_t l = 0; l < levels.size(); ++l) {
+            Level &level = levels[l];
+            if (l > 0) {
+                for (int a = 0; a < 2; ++a) {
+                    origin[a] -= (m - 1) * level.spacing;
+                    if (floorMod(origin[a], 2 * level.spacing) != 0) origin[a] -= level.spacing;
+                }
+            }
+            recentre(l, origin[0] / level.spacing, origin[1] / level.spacing);
+        }
+    }
+
+    // Draws every level with a shader built from clipmap_vshader, after an
+    // update; the level textures are bound to textureUnit. Patches off the
+    // map are skipped.
+    void draw(Shader &shader, const int textureUnit) {
+        shader.set_uniform("levelTex", textureUnit);
+        shader.set_uniform("levelMask", textureSize - 1);
+        shader.set_uniform("morph", Vec3(2 * m - 1.0f, n / 10.0f, 0.0f));
+        shader.set_uniform("mapLayout", Vec3(x0, y0, cellSize));
+        shader.set_uniform("mapWidth", mapWidth);
+        shader.set_uniform("mapHeight", mapHeight);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(restart);
+
+        triangles = 0;
+        for (size_t l = 0; l < levels.size(); ++l) {
+            const Level &level = levels[l];
+            glActiveTexture(GL_TEXTURE0 + textureUnit);
+            level.texture->bind();
+            shader.set_uniform("levelOrigin", Vec3((float) level.origin[0], (float) level.origin[1], (float) level.spacing));
+
+            if (l == 0) {
+                drawPatch(shader, level, full, 0, 0);
+                continue;
+            }
+
+            const int offsets[4] = { 0, m - 1, 2 * m, 3 * m - 1 };
+            for (int a = 0; a < 4; ++a) {
+                for (int b = 0; b < 4; ++b) {
+                    bool hole = (a == 1 || a == 2) && (b == 1 || b == 2);
+                    if (!hole) drawPatch(shader, level, block, offsets[a], offsets[b]);
+                }
+            }
+            drawPatch(shader, level, fixupI, 2 * m - 2, 0);
+            drawPatch(shader, level, fixupI, 2 * m - 2, 3 * m - 1);
+            drawPatch(shader, level, fixupJ, 0, 2 * m - 2);
+            drawPatch(shader, level, fixupJ, 3 * m - 1, 2 * m - 2);
+
+            // The finer level covers 2m - 1 of the 2m cells of the hole, m - 1
+            // or m vertices in; the trim fills the cell left on each axis
+            const Level &finer = levels[l - 1];
+            int inset[2];
+            for (int a = 0; a < 2; ++a) {
+                inset[a] = (finer.origin[a] * finer.spacing - level.origin[a] * level.spacing) / level.spacing;
+            }
+            int ti = inset[0] == m - 1 ? 3 * m - 2 : m - 1;
+            int tj = inset[1] == m - 1 ? 3 * m - 2 : m - 1;
+            drawPatch(shader, level, trimI, ti, m - 1);
+            drawPatch(shader, level, trimJ, ti == m - 1 ? m : m - 1, tj);
+        }
+    }
+
+    int levelCount() const { return (int) levels.size(); }
+
+    // Triangles in the last draw
+    size_t trianglesDrawn() const { return triangles; }
+
+private:
+
+    struct Patch {
+        std::unique_ptr<GPUMesh> mesh;
+        int width;
+        int height;
+    };
+
+    struct Level {
+        int spacing = 1;                        // heightmap samples between vertices
+        int size[2] = { 0, 0 };                 // samples of this level on the map
+        std::vector<float> heights;             // world heights at [i + j * size[0]]
+        std::unique_ptr<RG32FTexture> texture;  // (fine, coarse) heights, toroidal
+        int origin[2] = { 0, 0 };               // level sample (i, j) of vertex (0, 0)
+        bool valid = false;                     // texture holds the window at origin
+    };
+
+    static int floorDiv(const int a, const int b) {
+        return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+
+    static int floorMod(const int a, const int b) {
+        return a - floorDiv(a, b) * b;
+    }
+
+    // Every other sample of the finer level, [1 2 1] filtered so the coarse
+    // levels do not alias
+    static void downsample(const Level &fine, Level &coarse, WorkerPool &pool) {
+        coarse.spacing = 2 * fine.spacing;
+        coarse.size[0] = (fine.size[0] + 1) / 2;
+        coarse.size[1] = (fine.size[1] + 1) / 2;
+        coarse.heights.resize((size_t) coarse.size[0] * coarse.size[1]);
+        pool.parallelFor(coarse.size[1], [&](int rowBegin, int rowEnd) {
+            for (int j = rowBegin; j < rowEnd; ++j) {
+                for (int i = 0; i < coarse.size[0]; ++i) {
+                    float sum = 0.0f;
+                    for (int dj = -1; dj <= 1; ++dj) {
+                        for (int di = -1; di <= 1; ++di) {
+                            float w = (di == 0 ? 2.0f : 1.0f) * (dj == 0 ? 2.0f : 1.0f);
+                            sum += w * sampleAt(fine, 2 * i + di, 2 * j + dj);
+                        }
+                    }
+                    coarse.heights[i + (size_t) j * coarse.size[0]] = sum / 16.0f;
+                }
+            }
+        });
+    }
+
+    // Level textures and patch meshes, on the thread that draws
+    void createGL() {
+        if (full.mesh) return;
+        for (size_t l = 0; l < levels.size(); ++l) {
+            levels[l].texture = std::unique_ptr<RG32FTexture>(new RG32FTexture());
+            levels[l].texture->disable_filter();
+            std::vector<float> texels(2 * textureSize * textureSize, 0.0f);
+            levels[l].texture->upload_raw(textureSize, textureSize, texels.data());
+        }
+
+        // Patch meshes: vertices come from gl_VertexID, so only indices
+        full = patchMesh(n, n);
+        block = patchMesh(m, m);
+        fixupI = patchMesh(3, m);
+        fixupJ = patchMesh(m, 3);
+        trimI = patchMesh(2, 2 * m + 1);
+        trimJ = patchMesh(2 * m, 2);
+    }
+
+    // Clamped to the map, like the texture's edges
+    static float sampleAt(const Level &level, int i, int j) {
+        i = std::min(std::max(i, 0), level.size[0] - 1);
+        j = std::min(std::max(j, 0), level.size[1] - 1);
+        return level.heights[i + (size_t) j * level.size[0]];
+    }
+
+    // The coarser level's surface at sample (i, j) of level l: its own sample
+    // where the two coincide, the mean of its neighbours between them
+    float coarseAt(const size_t l, const int i, const int j) const {
+        if (l + 1 >= levels.size()) return sampleAt(levels[l], i, j);
+        const Level &coarse = levels[l + 1];
+        int i0 = floorDiv(i, 2), j0 = floorDiv(j, 2);
+        int i1 = i0 + (i & 1), j1 = j0 + (j & 1);
+        return 0.25f * (sampleAt(coarse, i0, j0) + sampleAt(coarse, i1, j0) +
+                        sampleAt(coarse, i0, j1) + sampleAt(coarse, i1, j1));
+    }
+
+    // Moves level l's window to origin (i, j) in level samples and uploads the
+    // rows and columns that were not in the old window
+    void recentre(const size_t l, const int i, const int j) {
+        Level &level = levels[l];
+        int di = i - level.origin[0], dj = j - level.origin[1];
+        if (level.valid && di == 0 && dj == 0) return;
+
+        if (!level.valid || std::abs(di) >= n || std::abs(dj) >= n) {
+            upload(l, i, j, n, n);
+        } else {
+            if (di != 0) upload(l, di > 0 ? level.origin[0] + n : i, j, std::abs(di), n);
+            if (dj != 0) upload(l, i, dj > 0 ? level.origin[1] + n : j, n, std::abs(dj));
+        }
+        level.origin[0] = i;
+        level.origin[1] = j;
+        level.valid = true;
+    }
+
+    // Samples [i, i + w) x [j, j + h) of level l into their toroidal texels,
+    // split where the region wraps around the texture
+    void upload(const size_t l, const int i, const int j, const int w, const int h) {
+        const int mask = textureSize - 1;
+        std::vector<float> texels;
+        levels[l].texture->bind();
+        for (int b = j; b < j + h;) {
+            int rows = std::min(j + h - b, textureSize - (b & mask));
+            for (int a = i; a < i + w;) {
+                int columns = std::min(i + w - a, textureSize - (a & mask));
+                texels.resize(2 * (size_t) columns * rows);
+                for (int y = 0; y < rows; ++y) {
+                    for (int x = 0; x < columns; ++x) {
+                        float *t = &texels[2 * (x + (size_t) y * columns)];
+                        t[0] = sampleAt(levels[l], a + x, b + y);
+                        t[1] = coarseAt(l, a + x, b + y);
+                    }
+                }
+                glTexSubImage2D(GL_TEXTURE_2D, 0, a & mask, b & mask, columns, rows, GL_RG, GL_FLOAT, texels.data());
+                a += columns;
+            }
+            b += rows;
+        }
+        levels[l].texture->unbind();
+    }
+
+    Patch patchMesh(const int width, const int height) const {
+        Patch patch;
+        patch.mesh = patchIndexMesh(width, height, restart);
+        patch.width = width;
+        patch.height = height;
+        return patch;
+    }
+
+    // Patch with its vertex (0, 0) at level vertex (pi, pj)
+    void drawPatch(Shader &shader, const Level &level, Patch &patch, const int pi, const int pj) {
+        int i0 = (level.origin[0] + pi) * level.spacing, j0 = (level.origin[1] + pj) * level.spacing;
+        int i1 = i0 + (patch.width - 1) * level.spacing, j1 = j0 + (patch.height - 1) * level.spacing;
+        if (i1 < 0 || j1 < 0 || i0 > mapWidth - 1 || j0 > mapHeight - 1) return;
+
+        shader.set_uniform("patchOrigin", Vec3((float) pi, (float) pj, (float) patch.width));
+        patch.mesh->draw();
+        triangles += 2 * (size_t)(patch.width - 1) * (patch.height - 1);
+    }
+
+    const int m;
+    const int n;
+    const int textureSize;
+    const unsigned int restart;
+    const int mapWidth, mapHeight;
+    const float x0, y0, cellSize;
+
+    std::vector<Level> levels;
+    Patch full, block, fixupI, fixupJ, trimI, trimJ;
+    size_t triangles = 0;
+};
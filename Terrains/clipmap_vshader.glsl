@@ -0,0 +1,59 @@
+R"(
+#version 330 core
+
+// One patch of a geometry clipmap level (GeometryClipmap in clipmap.h). The
+// vertex is gl_VertexID on a patch of patchOrigin.z vertices per row; the
+// level texture holds (fine, coarse) world heights of the level's samples,
+// wrapped toroidally.
+uniform sampler2D levelTex;
+uniform int levelMask;          // texture size - 1
+
+// Level sample (i, j) of the level's vertex (0, 0), and heightmap samples
+// between vertices
+uniform vec3 levelOrigin;
+// Level vertex (i, j) of the patch's vertex (0, 0), and its vertices per row
+uniform vec3 patchOrigin;
+// Level vertex at the level's centre, and vertices over which heights blend
+// into the coarser level towards its edge
+uniform vec3 morph;
+
+// Sample (i, j) lies at world (mapLayout.x + j * mapLayout.z, mapLayout.y + i * mapLayout.z)
+uniform vec3 mapLayout;
+uniform int mapWidth;
+uniform int mapHeight;
+
+uniform mat4 M;
+uniform mat4 V;
+uniform mat4 P;
+
+out vec2 uv;
+out vec2 heightUV;
+out vec3 fragPos;
+
+out float waterHeight;
+
+void main() {
+
+    int width = int(patchOrigin.z);
+    ivec2 local = ivec2(patchOrigin.xy) + ivec2(gl_VertexID % width, gl_VertexID / width);
+    ivec2 level = ivec2(levelOrigin.xy) + local;
+    vec2 h = texelFetch(levelTex, level & levelMask, 0).rg;
+
+    // Blend to the coarser level's surface near the edge, so the outermost
+    // vertices lie on its triangles
+    vec2 d = abs(vec2(local) - morph.x);
+    float alpha = clamp((max(d.x, d.y) - (morph.x - morph.y - 1.0)) / morph.y, 0.0, 1.0);
+
+    // Vertices past the edge of the map fold onto it
+    vec2 texel = clamp(vec2(level) * levelOrigin.z, vec2(0.0), vec2(mapWidth - 1, mapHeight - 1));
+    uv = (texel + 0.5) / vec2(mapWidth, mapHeight);
+    heightUV = uv;
+
+    fragPos = vec3(mapLayout.x + texel.y * mapLayout.z, mapLayout.y + texel.x * mapLayout.z, mix(h.r, h.g, alpha));
+
+    gl_Position = P*V*M*vec4(fragPos, 1.0f);
+
+    // Earth scene
+    waterHeight = 0.53f;
+}
+)"
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "parallel.h"
+
+// Erosion of a generated heightmap: grid-based hydraulic erosion (the
+// virtual pipe model: rain, water flow through pipes between neighbouring
+// cells, sediment pick-up and deposition, sediment carried through the same
+// pipes and evaporation) followed by thermal talus relaxation.
+//
+// Every step is a gather: a cell only writes its own state and only reads
+// the state its neighbours had before the step, so the map is cut into tiles
+// that run on the worker pool, each reading a one-cell halo from its
+// neighbours through the double-buffered arrays. Results do not depend on
+// the tiling or the thread count.
+//
+// Internally heights are in cells (height / cellSize), so a slope of 1 is 45
+// degrees whatever the resolution.
+
+struct ErosionParams {
+    int hydraulicIterations = 0;
+    int thermalIterations = 0;
+
+    // Hydraulic
+    float timeStep = 0.05f;
+    float rain = 0.02f;             // water added per unit time, in cells
+    float gravity = 9.81f;
+    float capacity = 1.0f;          // sediment carried per unit discharge and slope
+    float dissolving = 0.05f;       // fraction of the missing capacity picked up per step
+    float depositing = 0.05f;       // fraction of the excess sediment dropped per step
+    float evaporation = 0.02f;      // fraction of the water lost per unit time
+    float minSlope = 0.05f;         // keeps water on flat ground carrying something
+    float maxErosionDepth = 0.1f;   // cap on what one step removes, in cells
+    float stillWater = 1.0f;        // water this deep (in cells) no longer erodes: lakes fill, not dig
+
+    // Thermal
+    float talus = 1.2f;             // tangent of the angle of repose
+    float thermalRate = 0.5f;       // fraction of the excess moved per iteration
+
+    bool enabled() const { return hydraulicIterations > 0 || thermalIterations > 0; }
+};
+
+// Edge length of the tiles handed to the worker pool
+const int erosionTileSize = 128;
+
+// Calls fn(i0, j0, i1, j1) for every tile of a width x height map, in parallel
+template <typename Fn>
+void forEachErosionTile(const int width, const int height, Fn fn) {
+    const int tilesX = (width + erosionTileSize - 1) / erosionTileSize;
+    const int tilesY = (height + erosionTileSize - 1) / erosionTileSize;
+    noisePool().parallelFor(tilesX * tilesY, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            int i0 = (t % tilesX) * erosionTileSize, j0 = (t / tilesX) * erosionTileSize;
+            fn(i0, j0, std::min(i0 + erosionTileSize, width), std::min(j0 + erosionTileSize, height));
+        }
+    }, 1);
+}
+
+class Erosion {
+public:
+
+    // samples are stored at [i + j * width] like the textures; cellSize is
+    // the spacing of the samples in height units
+    Erosion(const float *samples, const int width, const int height, const float cellSize)
+        : width(width), height(height), cellSize(cellSize) {
+        size_t count = (size_t) width * height;
+        terrain.resize(count);
+        terrainNext.resize(count);
+        for (size_t k = 0; k < count; ++k) {
+            terrain[k] = samples[k] / cellSize;
+        }
+    }
+
+    // Runs params.hydraulicIterations hydraulic steps
+    void hydraulic(const ErosionParams &params) {
+        if (params.hydraulicIterations <= 0) return;
+
+        size_t count = (size_t) width * height;
+        water.assign(count, params.rain * params.timeStep);
+        waterNext.assign(count, 0.0f);
+        sediment.assign(count, 0.0f);
+        sedimentNext.assign(count, 0.0f);
+        for (int d = 0; d < 4; ++d) flux[d].assign(count, 0.0f);
+
+        for (int it = 0; it < params.hydraulicIterations; ++it) {
+            forEachErosionTile(width, height, [&](int i0, int j0, int i1, int j1) { updateFlux(params, i0, j0, i1, j1); });
+            forEachErosionTile(width, height, [&](int i0, int j0, int i1, int j1) { updateWater(params, i0, j0, i1, j1); });
+            forEachErosionTile(width, height, [&](int i0, int j0, int i1, int j1) { transportSediment(params, i0, j0, i1, j1); });
+            terrain.swap(terrainNext);
+            water.swap(waterNext);
+        }
+
+        // What is still suspended settles where it is
+        for (size_t k = 0; k < count; ++k) terrain[k] += sediment[k];
+
+        water = std::vector<float>();
+        waterNext = std::vector<float>();
+        sediment = std::vector<float>();
+        sedimentNext = std::vector<float>();
+        for (int d = 1; d < 4; ++d) flux[d] = std::vector<float>();
+    }
+
+    // Runs params.thermalIterations talus relaxation steps
+    void thermal(const ErosionParams &params) {
+        if (params.thermalIterations <= 0) return;
+
+        // flux[0] holds each cell's outflow per unit excess
+        flux[0].assign((size_t) width * height, 0.0f);
+        for (int it = 0; it < params.thermalIterations; ++it) {
+            forEachErosionTile(width, height, [&](int i0, int j0, int i1, int j1) { talusOutflow(params, i0, j0, i1, j1); });
+            forEachErosionTile(width, height, [&](int i0, int j0, int i1, int j1) { talusGather(params, i0, j0, i1, j1); });
+            terrain.swap(terrainNext);
+        }
+        flux[0] = std::vector<float>();
+    }
+
+    // Heights back in the units the samples came in
+    void heights(float *samples) const {
+        for (size_t k = 0; k < terrain.size(); ++k) {
+            samples[k] = terrain[k] * cellSize;
+        }
+    }
+
+    const int width;
+    const int height;
+    const float cellSize;
+
+private:
+
+    // Calls cell(k, l, r, t, b) for every cell of the tile, with the offsets
+    // of its left, right, up and down neighbour. At an edge the offset is 0:
+    // a cell is its own neighbour, which makes the height difference across
+    // the edge zero. Interior cells get constant offsets so the loop vectorises.
+    template <typename Cell>
+    void forEachCell(int i0, int j0, int i1, int j1, Cell cell) const {
+        for (int j = j0; j < j1; ++j) {
+            const int t = j > 0 ? -width : 0;
+            const int b = j < height - 1 ? width : 0;
+            const size_t row = (size_t) j * width;
+            int begin = i0, end = i1;
+            if (begin == 0) {
+                cell(row, 0, 1, t, b);
+                begin = 1;
+            }
+            if (end == width) --end;
+            for (int i = begin; i < end; ++i) {
+                cell(row + i, -1, 1, t, b);
+            }
+            if (end != i1) cell(row + width - 1, -1, 0, t, b);
+        }
+    }
+
+    // Outflow through the four pipes, scaled so no cell gives more water than it has
+    void updateFlux(const ErosionParams &params, int i0, int j0, int i1, int j1) {
+        const float dt = params.timeStep, g = dt * params.gravity;
+        const float *T = terrain.data(), *W = water.data();
+        float *F0 = flux[0].data(), *F1 = flux[1].data(), *F2 = flux[2].data(), *F3 = flux[3].data();
+        forEachCell(i0, j0, i1, j1, [&](size_t k, int l, int r, int t, int b) {
+            float level = T[k] + W[k];
+            float f0 = std::max(0.0f, F0[k] + g * (level - T[k + l] - W[k + l]));
+            float f1 = std::max(0.0f, F1[k] + g * (level - T[k + r] - W[k + r]));
+            float f2 = std::max(0.0f, F2[k] + g * (level - T[k + t] - W[k + t]));
+            float f3 = std::max(0.0f, F3[k] + g * (level - T[k + b] - W[k + b]));
+            float total = (f0 + f1 + f2 + f3) * dt;
+            float scale = total > W[k] ? W[k] / total : 1.0f;
+            F0[k] = f0 * scale;
+            F1[k] = f1 * scale;
+            F2[k] = f2 * scale;
+            F3[k] = f3 * scale;
+        });
+    }
+
+    // New water depth, then sediment picked up or dropped by the flow. What
+    // the water can carry grows with the discharge and the slope.
+    void updateWater(const ErosionParams &params, int i0, int j0, int i1, int j1) {
+        const float dt = params.timeStep;
+        const float *T = terrain.data(), *W = water.data(), *S = sediment.data();
+        const float *F0 = flux[0].data(), *F1 = flux[1].data(), *F2 = flux[2].data(), *F3 = flux[3].data();
+        float *TN = terrainNext.data(), *WN = waterNext.data(), *SN = sedimentNext.data();
+        forEachCell(i0, j0, i1, j1, [&](size_t k, int l, int r, int t, int b) {
+            // Water arriving from each neighbour; nothing comes in from beyond the edges
+            float inL = l ? F1[k + l] : 0.0f, inR = r ? F0[k + r] : 0.0f;
+            float inT = t ? F3[k + t] : 0.0f, inB = b ? F2[k + b] : 0.0f;
+            float in = inL + inR + inT + inB;
+            float out = F0[k] + F1[k] + F2[k] + F3[k];
+            float depth = std::max(0.0f, W[k] + dt * (in - out));
+            WN[k] = depth;
+
+            // Discharge through the cell along i and along j
+            float alongI = 0.5f * (inL - F0[k] + F1[k] - inR);
+            float alongJ = 0.5f * (inT - F2[k] + F3[k] - inB);
+
+            float gi = 0.5f * (T[k + r] - T[k + l]);
+            float gj = 0.5f * (T[k + b] - T[k + t]);
+            float slope2 = gi * gi + gj * gj;
+            float sine = std::max(std::sqrt(slope2 / (1.0f + slope2)), params.minSlope);
+            float shallow = std::max(0.0f, 1.0f - depth / params.stillWater);
+            float carry = params.capacity * sine * std::sqrt(alongI * alongI + alongJ * alongJ) * shallow;
+
+            float change = carry > S[k] ? -std::min(params.dissolving * (carry - S[k]), params.maxErosionDepth)
+                                        : params.depositing * (S[k] - carry);
+            TN[k] = T[k] + change;
+            SN[k] = S[k] - change;
+        });
+    }
+
+    // Sediment leaves each cell through the pipes in the same shares as its
+    // water (so none is lost), then evaporation and rain
+    void transportSediment(const ErosionParams &params, int i0, int j0, int i1, int j1) {
+        const float dt = params.timeStep;
+        const float keep = std::max(0.0f, 1.0f - params.evaporation * dt);
+        const float rain = params.rain * dt;
+        const float *W = water.data(), *SN = sedimentNext.data();
+        const float *F0 = flux[0].data(), *F1 = flux[1].data(), *F2 = flux[2].data(), *F3 = flux[3].data();
+        float *S = sediment.data(), *WN = waterNext.data();
+        // Sediment per unit of water flowing out of a cell this step
+        auto concentration = [&](size_t n) { return W[n] > 0.0f ? SN[n] * dt / W[n] : 0.0f; };
+        forEachCell(i0, j0, i1, j1, [&](size_t k, int l, int r, int t, int b) {
+            float out = (F0[k] + F1[k] + F2[k] + F3[k]) * concentration(k);
+            float in = (l ? F1[k + l] * concentration(k + l) : 0.0f) + (r ? F0[k + r] * concentration(k + r) : 0.0f) +
+                       (t ? F3[k + t] * concentration(k + t) : 0.0f) + (b ? F2[k + b] * concentration(k + b) : 0.0f);
+            S[k] = std::max(0.0f, SN[k] - out) + in;
+            WN[k] = WN[k] * keep + rain;
+        });
+    }
+
+    // Each cell moves thermalRate / 2 of its largest excess over the angle of
+    // repose, split over its 8 neighbours in proportion to their excess;
+    // stores the outflow per unit excess
+    void talusOutflow(const ErosionParams &params, int i0, int j0, int i1, int j1) {
+        const float straight = params.talus, diagonal = 1.41421356f * params.talus;
+        const float half = 0.5f * params.thermalRate;
+        const float *T = terrain.data();
+        float *R = flux[0].data();
+        forEachCell(i0, j0, i1, j1, [&](size_t k, int l, int r, int t, int b) {
+            float most = 0.0f, total = 0.0f;
+            auto add = [&](int n, float limit) {
+                float e = std::max(0.0f, T[k] - T[k + n] - limit);
+                most = std::max(most, e);
+                total += e;
+            };
+            add(l, straight); add(r, straight); add(t, straight); add(b, straight);
+            add(l + t, diagonal); add(r + t, diagonal); add(l + b, diagonal); add(r + b, diagonal);
+            R[k] = total > 0.0f ? half * most / total : 0.0f;
+        });
+    }
+
+    void talusGather(const ErosionParams &params, int i0, int j0, int i1, int j1) {
+        const float straight = params.talus, diagonal = 1.41421356f * params.talus;
+        const float *T = terrain.data(), *R = flux[0].data();
+        float *TN = terrainNext.data();
+        forEachCell(i0, j0, i1, j1, [&](size_t k, int l, int r, int t, int b) {
+            float h = T[k];
+            // The pairs are symmetric: n gives to k what k would give to n
+            auto exchange = [&](int n, float limit) {
+                h += R[k + n] * std::max(0.0f, T[k + n] - T[k] - limit) - R[k] * std::max(0.0f, T[k] - T[k + n] - limit);
+            };
+            exchange(l, straight); exchange(r, straight); exchange(t, straight); exchange(b, straight);
+            exchange(l + t, diagonal); exchange(r + t, diagonal); exchange(l + b, diagonal); exchange(r + b, diagonal);
+            TN[k] = h;
+        });
+    }
+
+    std::vector<float> terrain, terrainNext;
+    std::vector<float> water, waterNext;
+    std::vector<float> sediment, sedimentNext;
+    std::vector<float> flux[4];   // outflow to the left, right, up and down neighbour
+};
+
+// Erodes samples in place: hydraulic, then thermal
+inline void erodeHeightmap(float *samples, const int width, const int height, const float cellSize,
+                           const ErosionParams &params) {
+    if (!params.enabled()) return;
+    Erosion erosion(samples, width, height, cellSize);
+    erosion.hydraulic(params);
+    erosion.thermal(params);
+    erosion.heights(samples);
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include "noise.h"
+#include "noiseGraph.h"
+
+// Compile-time specialised fractal kernels. Octave count, integer lacunarity,
+// H (in thousandths) and the fade curve are template parameters, so the
+// exponent table is a constexpr array and the octave loop unrolls completely.
+// Presets pick one instantiation by name at runtime.
+
+// Fade curves as types, so the choice is part of the kernel's type
+struct QuinticFade { static float curve(float t) { return fade(t); } };
+struct CubicFade { static float curve(float t) { return cubicFade(t); } };
+
+// C++11 constexpr functions are single expressions, hence the recursion
+constexpr double constexprSquare(double v) {
+    return v * v;
+}
+
+constexpr double constexprExpSeries(double x, int n, double term, double sum) {
+    return n > 30 ? sum : constexprExpSeries(x, n + 1, term * x / n, sum + term * x / n);
+}
+
+// exp(x) = exp(x/2)^2 until the Taylor series converges quickly
+constexpr double constexprExp(double x) {
+    return (x > 0.5 || x < -0.5) ? constexprSquare(constexprExp(x / 2)) : constexprExpSeries(x, 1, 1.0, 1.0);
+}
+
+// atanh(z) = z + z^3/3 + z^5/5 + ...
+constexpr double constexprAtanh(double z2, double term, int n, double sum) {
+    return n > 61 ? sum : constexprAtanh(z2, term * z2, n + 2, sum + term * z2 / (n + 2));
+}
+
+// ln(x) = ln(x/2) + ln(2) until x <= 2, then 2 atanh((x-1)/(x+1))
+constexpr double constexprLn(double x) {
+    return x > 2.0 ? constexprLn(x / 2) + 0.69314718055994530942
+                   : 2.0 * constexprAtanh(((x - 1) / (x + 1)) * ((x - 1) / (x + 1)), (x - 1) / (x + 1), 1, (x - 1) / (x + 1));
+}
+
+// Compile-time list 0, 1, ..., N-1 (std::make_integer_sequence is C++14)
+template <int... K> struct IndexList {};
+template <int N, int... K> struct MakeIndexList : MakeIndexList<N - 1, N - 1, K...> {};
+template <int... K> struct MakeIndexList<0, K...> { typedef IndexList<K...> type; };
+
+template <typename Kernel, typename List> struct ExponentTable;
+
+template <typename Kernel, int... K>
+struct ExponentTable<Kernel, IndexList<K...>> {
+    static constexpr float values[sizeof...(K)] = { Kernel::exponent(K)... };
+};
+
+template <typename Kernel, int... K>
+constexpr float ExponentTable<Kernel, IndexList<K...>>::values[sizeof...(K)];
+
+// fBm octave K of N, unrolled by recursion on K
+template <typename Kernel, int K, int N>
+struct FBmOctaves {
+    static inline float sum(const float *rows, int *columns, const int *steps, int width, float offset, float noise) {
+        float perlin = rows[K * width + columns[K]];
+        noise += (perlin + offset) * Kernel::Exponents::values[K];
+
+        columns[K] += steps[K];
+        if (columns[K] >= width) columns[K] -= width;
+
+        return FBmOctaves<Kernel, K + 1, N>::sum(rows, columns, steps, width, offset, noise);
+    }
+};
+
+template <typename Kernel, int N>
+struct FBmOctaves<Kernel, N, N> {
+    static inline float sum(const float *, int *, const int *, int, float, float noise) {
+        return noise;
+    }
+};
+
+// Hybrid multifractal weight recursion, octave K of N
+template <typename Kernel, int K, int N>
+struct HybridOctaves {
+    static inline float sum(float perlin, float weight, float offset) {
+        if (weight > 1.0) {
+            weight = 1.0;
+        }
+        float signal = (perlin + offset) * Kernel::Exponents::values[K];
+        perlin += weight * signal;
+        weight *= signal;
+        return HybridOctaves<Kernel, K + 1, N>::sum(perlin, weight, offset);
+    }
+};
+
+template <typename Kernel, int N>
+struct HybridOctaves<Kernel, N, N> {
+    static inline float sum(float perlin, float, float) {
+        return perlin;
+    }
+};
+
+template <int Octaves, int Lacunarity, int HMilli, typename Fade = QuinticFade>
+struct FractalKernel {
+
+    static_assert(Octaves > 0, "A fractal needs at least one octave");
+    static_assert(Lacunarity > 1, "Lacunarity must be an integer greater than one");
+
+    static constexpr float H = HMilli / 1000.0f;
+
+    // lacunarity^(-H k), the same value fractalExponents computes at runtime
+    static constexpr float exponent(int k) {
+        return (float) constexprExp(-(double) H * k * constexprLn(Lacunarity));
+    }
+
+    typedef ExponentTable<FractalKernel, typename MakeIndexList<Octaves>::type> Exponents;
+
+    static FractalParams params(float offset) {
+        FractalParams p;
+        p.H = H;
+        p.lacunarity = (float) Lacunarity;
+        p.offset = offset;
+        p.octaves = Octaves;
+        return p;
+    }
+
+    // Same algorithm as fBmRow with the octave loop unrolled
+    static void fBmRow(const PerlinLattice &lattice, float offset, int j, float *out, FractalScratch &scratch) {
+        const int width = lattice.width;
+        scratch.rows.resize(Octaves * width);
+
+        int steps[Octaves];
+        int columns[Octaves];
+        int J = j % lattice.height;
+        int step = 1;
+        for (int k = 0; k < Octaves; ++k) {
+            lattice.fillRow(J, 0, width, &scratch.rows[k * width]);
+            steps[k] = step;
+            columns[k] = 0;
+            J = (J * Lacunarity) % lattice.height;
+            step = (step * Lacunarity) % width;
+        }
+
+        const float *rows = scratch.rows.data();
+        for (int i = 0; i < width; ++i) {
+            out[i] = FBmOctaves<FractalKernel, 0, Octaves>::sum(rows, columns, steps, width, offset, 0.0f);
+        }
+    }
+
+    // Same algorithm as hybridMultifractalRow with the octave loop unrolled
+    static void hybridRow(const PerlinLattice &lattice, float offset, int j, float *out, FractalScratch &scratch) {
+        scratch.rows.resize(lattice.width);
+        lattice.fillRow(j % lattice.height, 0, lattice.width, scratch.rows.data());
+
+        for (int i = 0; i < lattice.width; ++i) {
+            float perlin = 1 - abs(scratch.rows[i]);
+            out[i] = HybridOctaves<FractalKernel, 1, Octaves>::sum(perlin, perlin, offset);
+        }
+    }
+
+    static float* fBm2D(const int width, const int height, const int period, const uint64_t seed, const float offset) {
+        PerlinLattice lattice(width, height, period, seed, &Fade::curve);
+        return fractal2D(width, height, [&](int j, float *row, FractalScratch &scratch) {
+            fBmRow(lattice, offset, j, row, scratch);
+        });
+    }
+
+    static float* HybridMultifractal2D(const int width, const int height, const int period, const uint64_t seed, const float offset) {
+        PerlinLattice lattice(width, height, period, seed, &Fade::curve);
+        return fractal2D(width, height, [&](int j, float *row, FractalScratch &scratch) {
+            hybridRow(lattice, offset, j, row, scratch);
+        });
+    }
+};
+
+// A named terrain look: a kernel instantiation plus its runtime parameters
+struct FractalPreset {
+    std::string name;
+    FractalParams params;
+    bool hybrid;
+    bool cubicFade;
+    NoiseBasis basis = NoiseBasis::Perlin;
+    float* (*generate)(const int width, const int height, const int period, const uint64_t seed, const float offset);
+
+    // Set for looks built as noise graphs; params feed the graph's fractals
+    // and the basis is part of the graph
+    float* (*compose)(const int width, const int height, const int period, const uint64_t seed,
+                      const FractalParams &params) = nullptr;
+
+    // The specialised kernels are Perlin only; a simplex preset goes through
+    // the runtime drivers with the same parameters (the fade does not apply)
+    float* generate2D(const int width, const int height, const int period, const uint64_t seed) const {
+        if (compose) {
+            return compose(width, height, period, seed, params);
+        }
+        if (basis == NoiseBasis::Simplex) {
+            return hybrid ? HybridMultifractal2D(width, height, period, seed, params, basis)
+                          : fBm2D(width, height, period, seed, params, basis);
+        }
+        return generate(width, height, period, seed, params.offset);
+    }
+};
+
+template <typename Kernel>
+FractalPreset makeFBmPreset(const std::string &name, float offset, bool cubic) {
+    FractalPreset preset;
+    preset.name = name;
+    preset.params = Kernel::params(offset);
+    preset.hybrid = false;
+    preset.cubicFade = cubic;
+    preset.generate = &Kernel::fBm2D;
+    return preset;
+}
+
+template <typename Kernel>
+FractalPreset makeHybridPreset(const std::string &name, float offset, bool cubic) {
+    FractalPreset preset = makeFBmPreset<Kernel>(name, offset, cubic);
+    preset.hybrid = true;
+    preset.generate = &Kernel::HybridMultifractal2D;
+    return preset;
+}
+
+// Ridged mountains in fBm hills, placed by a domain-warped simplex mask. The
+// hills use params as given; the ridges are the ridged fBm sum (offset 0,
+// one more octave).
+inline float* alpineGraph2D(const int width, const int height, const int period, const uint64_t seed,
+                            const FractalParams &params) {
+    const double frequency = (double) width / period;   // cycles per map
+    FractalParams ridgeParams = params;
+    ridgeParams.offset = 0.0f;
+    ridgeParams.octaves = params.octaves + 1;
+
+    auto hills = fBmNode(perlinNode(seed, frequency), params);
+    auto peaks = scaleBiasNode(ridgedNode(fBmNode(perlinNode(mix64(seed + 1), frequency), ridgeParams)), 1.2f, -0.2f);
+    auto mask = warpNode(simplexNode(mix64(seed + 2), 0.5 * frequency), simplexNode(mix64(seed + 3), 2 * frequency),
+                         simplexNode(mix64(seed + 4), 2 * frequency), 0.25f * period / width);
+    return evaluateGraph2D(width, height, blendNode(hills, peaks, mask, -0.15f, 0.15f));
+}
+
+template <typename Kernel>
+FractalPreset makeGraphPreset(const std::string &name, float offset,
+                              float* (*compose)(const int, const int, const int, const uint64_t, const FractalParams &)) {
+    FractalPreset preset = makeFBmPreset<Kernel>(name, offset, false);
+    preset.compose = compose;
+    return preset;
+}
+
+inline const std::map<std::string, FractalPreset> &fractalPresets() {
+    static std::map<std::string, FractalPreset> presets;
+    if (presets.empty()) {
+        // fBm parameters - Summer
+        presets["summer"] = makeFBmPreset<FractalKernel<5, 2, 900>>("summer", 0.1f, false);
+        presets["summer-cubic"] = makeFBmPreset<FractalKernel<5, 2, 900, CubicFade>>("summer-cubic", 0.1f, true);
+
+        // Hybrid Multifractal with the summer parameters (HybridMultifractal2DTexture)
+        presets["summer-hybrid"] = makeHybridPreset<FractalKernel<5, 2, 900>>("summer-hybrid", 0.1f, false);
+
+        // Hybrid Multifractal parameters - Lunar
+        presets["lunar"] = makeHybridPreset<FractalKernel<43, 4, 800>>("lunar", 0.7f, false);
+        presets["lunar-rough"] = makeHybridPreset<FractalKernel<16, 2, 250>>("lunar-rough", 0.7f, false);
+
+        // Noise graph with the summer parameters
+        presets["alpine"] = makeGraphPreset<FractalKernel<5, 2, 900>>("alpine", 0.1f, &alpineGraph2D);
+    }
+    return presets;
+}
+
+// nullptr if no preset has that name
+inline const FractalPreset *findFractalPreset(const std::string &name) {
+    const std::map<std::string, FractalPreset> &presets = fractalPresets();
+    std::map<std::string, FractalPreset>::const_iterator it = presets.find(name);
+    return it == presets.end() ? nullptr : &it->second;
+}
+
+// Heightmap texture for a preset, at the resolution of fBm2DTexture; samples,
+// if given, receives a CPU copy of the heights
+R32FTexture* fractalPresetTexture(const FractalPreset &preset, const uint64_t seed=defaultNoiseSeed,
+                                  std::vector<float> *samples=nullptr) {
+    const int width = 2048;
+    const int height = 2048;
+
+    float *noise_data = preset.generate2D(width, height, 512, seed);
+
+    R32FTexture* _tex = new R32FTexture();
+    _tex->upload_raw(width, height, noise_data);
+    if (samples) {
+        samples->assign(noise_data, noise_data + width * height);
+    }
+
+    delete[] noise_data;
+    return _tex;
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <OpenGP/GL/Application.h>
+#include "parallel.h"
+#include "vertexCache.h"
+
+using namespace OpenGP;
+
+// What a grid vertex stores. Full: a Vec3 position and a Vec2 uv (20 bytes).
+// Compact: the 16-bit index pair (i, j) as "vgrid" (4 bytes). None: nothing;
+// the vertex shader derives (i, j) from gl_VertexID. Compact and None get
+// position and uv from the gridN and gridSize uniforms (grid_vertex.glsl).
+// Instanced is for patches of the grid drawn as instances (waterTiles.h):
+// the tile's first (i, j) per instance plus gl_VertexID within the tile.
+// Projected: (i, j) where a screen-space vertex's view ray meets the plane
+// (projectedGrid.h).
+enum class GridVertexFormat { Full, Compact, None, Instanced, Projected };
+
+inline const char *gridVertexFormatName(GridVertexFormat format) {
+    switch (format) {
+        case GridVertexFormat::Compact: return "compact";
+        case GridVertexFormat::None: return "none";
+        case GridVertexFormat::Instanced: return "instanced";
+        case GridVertexFormat::Projected: return "projected";
+        default: return "full";
+    }
+}
+
+inline bool parseGridVertexFormat(const std::string &name, GridVertexFormat &format) {
+    if (name == "full") format = GridVertexFormat::Full;
+    else if (name == "compact") format = GridVertexFormat::Compact;
+    else if (name == "none") format = GridVertexFormat::None;
+    else return false;
+    return true;
+}
+
+using GridIndex16 = Eigen::Matrix<unsigned short, 2, 1>;
+
+// CPU side of the flat grids the terrain and water meshes are drawn with
+struct GridMesh {
+    std::vector<Vec3> points;
+    std::vector<Vec2> texCoords;
+    std::vector<unsigned int> indices;
+};
+
+// Grids are built straight into buffers of the exact size: every count is
+// known up front, each row's vertices and strip start at a fixed offset, so
+// rows are written in parallel and indices are computed in integers.
+// pool == nullptr builds on the calling thread.
+
+inline size_t gridVertexCount(const int w, const int h) {
+    return (size_t) w * h;
+}
+
+// One strip of 2w indices and a restart per row pair
+inline size_t patchIndexCount(const int w, const int h) {
+    return h > 1 ? (size_t)(h - 1) * (2 * (size_t) w + 1) : 0;
+}
+
+inline void forEachGridRow(const int rows, WorkerPool *pool, const std::function<void(int, int)> &fn) {
+    if (pool) {
+        pool->parallelFor(rows, fn, 16);
+    } else {
+        fn(0, rows);
+    }
+}
+
+// Triangle strips of a w x h grid with vertex (j, i) at index i + j * w,
+// into patchIndexCount(w, h) indices. The restart index must not be a vertex.
+inline void writePatchIndices(const int w, const int h, const unsigned int restart, unsigned int *indices,
+                              WorkerPool *pool = nullptr) {
+    assert(gridVertexCount(w, h) <= restart);
+    forEachGridRow(h - 1, pool, [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++j) {
+            unsigned int *strip = indices + (size_t) j * (2 * (size_t) w + 1);
+            unsigned int row = (unsigned int) j * (unsigned int) w;
+            for (int i = 0; i < w; ++i) {
+                strip[2 * i] = row + i;
+                strip[2 * i + 1] = row + w + i;
+            }
+
+            // A new strip will begin when this index is reached
+            strip[2 * w] = restart;
+        }
+    });
+}
+
+inline void generatePatchIndices(const int w, const int h, const unsigned int restart, std::vector<unsigned int> &indices,
+                                 WorkerPool *pool = nullptr) {
+    indices.resize(patchIndexCount(w, h));
+    writePatchIndices(w, h, restart, indices.data(), pool);
+}
+
+inline void generateGridIndices(const int n, const unsigned int restart, std::vector<unsigned int> &indices,
+                                WorkerPool *pool = nullptr) {
+    generatePatchIndices(n, n, restart, indices, pool);
+}
+
+// Index-only mesh of a w x h patch, for shaders that take the vertex from
+// gl_VertexID = i + j * w; strips in cache-sized bands (vertexCache.h)
+inline std::unique_ptr<GPUMesh> patchIndexMesh(const int w, const int h, const unsigned int restart) {
+    std::unique_ptr<GPUMesh> mesh(new GPUMesh());
+    std::vector<unsigned int> indices;
+    generateTiledPatchIndices(w, h, tiledBandWidth(), restart, indices);
+    mesh->set_triangles(indices);
+    mesh->set_mode(GL_TRIANGLE_STRIP);
+    return mesh;
+}
+
+// n x n vertices covering size x size world units centred at (0, 0), at
+// height z. Vertex (j, i) sits at x = -size/2 + j/n * size, y = -size/2 + i/n * size
+// with uv (i/(n-1), j/(n-1)); each row pair is one triangle strip ended by
+// the restart index.
+inline void writeGridPoints(const int n, const float size, const float z, Vec3 *points, WorkerPool *pool = nullptr) {
+    forEachGridRow(n, pool, [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++j) {
+            float vertX = -size / 2 + j / (float)n * size;
+            Vec3 *row = points + (size_t) j * n;
+            for (int i = 0; i < n; ++i) {
+                row[i] = Vec3(vertX, -size / 2 + i / (float)n * size, z);
+            }
+        }
+    });
+}
+
+inline void writeGridTexCoords(const int n, Vec2 *texCoords, WorkerPool *pool = nullptr) {
+    forEachGridRow(n, pool, [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++j) {
+            float texY = j / (float)(n - 1);
+            Vec2 *row = texCoords + (size_t) j * n;
+            for (int i = 0; i < n; ++i) {
+                row[i] = Vec2(i / (float)(n - 1), texY);
+            }
+        }
+    });
+}
+
+// The compact format's (i, j) pairs
+inline void writeGridIndex16(const int n, GridIndex16 *vgrid, WorkerPool *pool = nullptr) {
+    assert(n <= 65536);
+    forEachGridRow(n, pool, [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++j) {
+            GridIndex16 *row = vgrid + (size_t) j * n;
+            for (int i = 0; i < n; ++i) {
+                row[i] = GridIndex16((unsigned short) i, (unsigned short) j);
+            }
+        }
+    });
+}
+
+inline void generateGrid(const int n, const float size, const float z, const unsigned int restart, GridMesh &grid,
+                         WorkerPool *pool = nullptr) {
+    grid.points.resize(gridVertexCount(n, n));
+    grid.texCoords.resize(gridVertexCount(n, n));
+    writeGridPoints(n, size, z, grid.points.data(), pool);
+    writeGridTexCoords(n, grid.texCoords.data(), pool);
+    generateGridIndices(n, restart, grid.indices, pool);
+}
+
+// Indices of an n x n grid in the given order; gridIndexMode(order) says how
+// to draw them
+inline void generateOrderedGridIndices(const int n, const GridIndexOrder order, const unsigned int restart,
+                                       std::vector<unsigned int> &indices, WorkerPool *pool = nullptr) {
+    if (order == GridIndexOrder::Tiled) {
+        generateTiledPatchIndices(n, n, tiledBandWidth(), restart, indices, pool);
+    } else if (order == GridIndexOrder::Forsyth) {
+        std::vector<unsigned int> strips, triangles;
+        generateGridIndices(n, restart, strips, pool);
+        stripTriangles(strips, restart, triangles);
+        std::vector<unsigned int>().swap(strips);
+        optimizeVertexCache(triangles, gridVertexCount(n, n), indices);
+    } else {
+        generateGridIndices(n, restart, indices, pool);
+    }
+}
+
+inline size_t gridIndexCount(const int n, const GridIndexOrder order) {
+    if (order == GridIndexOrder::Tiled) return tiledPatchIndexCount(n, n, tiledBandWidth());
+    if (order == GridIndexOrder::Forsyth) return 6 * (size_t)(n - 1) * (n - 1);
+    return patchIndexCount(n, n);
+}
+
+// Prints, for each order of an n x n grid: how long it takes to build, its
+// indices, and its ACMR and ATVR on the modelled cache
+inline void reportVertexCacheOrders(const int n, const unsigned int restart, const int cacheSize = vertexCacheSize) {
+    const GridIndexOrder orders[] = { GridIndexOrder::Rows, GridIndexOrder::Tiled, GridIndexOrder::Forsyth };
+    for (int o = 0; o < 3; ++o) {
+        std::vector<unsigned int> indices;
+        auto start = std::chrono::steady_clock::now();
+        generateOrderedGridIndices(n, orders[o], restart, indices);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        VertexCacheStats stats = simulateVertexCache(indices, gridIndexMode(orders[o]), restart,
+                                                     gridVertexCount(n, n), cacheSize);
+        std::cout << "Grid " << n << "^2 [" << gridIndexOrderName(orders[o]) << "]: ACMR " << stats.acmr
+                  << ", ATVR " << stats.atvr << " (" << cacheSize << "-vertex FIFO), "
+                  << indices.size() << " indices, built in " << ms << " ms" << std::endl;
+    }
+}
+
+// GPU bytes of a grid mesh: vertex buffers in format plus the index buffer
+inline size_t gridBytes(const int n, GridVertexFormat format=GridVertexFormat::Full,
+                        GridIndexOrder order=GridIndexOrder::Rows) {
+    size_t vertex = format == GridVertexFormat::Full ? sizeof(Vec3) + sizeof(Vec2)
+                  : format == GridVertexFormat::Compact ? sizeof(GridIndex16) : 0;
+    return gridVertexCount(n, n) * vertex + gridIndexCount(n, order) * sizeof(unsigned int);
+}
+
+// Grids drawn by several surfaces, uploaded once per (n, size, restart,
+// format, order) and shared; the mesh's draw mode is set to match the
+// order. Grids are built at z = 0; each surface adds its own height with a
+// uniform, so a flat water sheet and the terrain use the same buffers.
+//
+// A grid is built one buffer at a time and each is freed once uploaded, so
+// building it needs no more memory than its largest buffer. Large grids are
+// built on a pool of their own: the shared one may be busy with a heightmap
+// generated in the background.
+class GridMeshCache {
+public:
+
+    std::shared_ptr<GPUMesh> get(const int n, const float size, const unsigned int restart,
+                                 GridVertexFormat format=GridVertexFormat::Full,
+                                 GridIndexOrder order=GridIndexOrder::Rows) {
+        requestedBytes += gridBytes(n, format, order);
+        std::shared_ptr<GPUMesh> &mesh = meshes[std::make_tuple(n, size, restart, format, order)];
+        if (mesh) return mesh;
+
+        mesh = std::shared_ptr<GPUMesh>(new GPUMesh());
+        std::unique_ptr<WorkerPool> pool;
+        if (n >= 256) pool = std::unique_ptr<WorkerPool>(new WorkerPool(noiseThreadSetting()));
+
+        if (format == GridVertexFormat::Full) {
+            {
+                std::vector<Vec3> points(gridVertexCount(n, n));
+                writeGridPoints(n, size, 0.0f, points.data(), pool.get());
+                mesh->set_vbo<Vec3>("vposition", points);
+            }
+            std::vector<Vec2> texCoords(gridVertexCount(n, n));
+            writeGridTexCoords(n, texCoords.data(), pool.get());
+            mesh->set_vtexcoord(texCoords);
+        } else if (format == GridVertexFormat::Compact) {
+            std::vector<GridIndex16> vgrid(gridVertexCount(n, n));
+            writeGridIndex16(n, vgrid.data(), pool.get());
+            mesh->set_vbo<GridIndex16>("vgrid", vgrid);
+        }
+        std::vector<unsigned int> indices;
+        generateOrderedGridIndices(n, order, restart, indices, pool.get());
+        mesh->set_triangles(indices);
+        mesh->set_mode(gridIndexMode(order));
+        sharedBytes += gridBytes(n, format, order);
+        return mesh;
+    }
+
+    size_t count() const { return meshes.size(); }
+
+    // GPU memory of the cached grids, and what one mesh per request would take
+    size_t bytes() const { return sharedBytes; }
+    size_t unsharedBytes() const { return requestedBytes; }
+
+private:
+    std::map<std::tuple<int, float, unsigned int, GridVertexFormat, GridIndexOrder>, std::shared_ptr<GPUMesh>> meshes;
+    size_t sharedBytes = 0;
+    size_t requestedBytes = 0;
+};
+
+inline GridMeshCache &gridMeshCache() {
+    static GridMeshCache cache;
+    return cache;
+}
@@ -0,0 +1,82 @@
+R"(
+// Grid vertex (j, i) of an n x n grid over size x size units centred at the
+// origin, laid out as generateGrid does. GRID_FORMAT (defined when the shader
+// is built) says where (j, i) comes from: 0 the full position and uv
+// attributes, 1 the 16-bit pair vgrid = (i, j), 2 gl_VertexID = i + j * n,
+// 3 the instance's tile corner vtile = (i, j) plus gl_VertexID on a tile of
+// tileVertices per row (clamped to the grid), 4 projected: the (fractional)
+// (i, j) of where a screen-space grid vertex's view ray meets the plane
+// (projectedGrid.h).
+uniform int gridN;
+uniform float gridSize;
+
+#if GRID_FORMAT == 0
+in vec3 vposition;
+in vec2 vtexcoord;
+#elif GRID_FORMAT == 1
+in vec2 vgrid;
+#elif GRID_FORMAT == 3
+in vec2 vtile;
+uniform int tileVertices;
+#elif GRID_FORMAT == 4
+// Vertex (column, row) at gl_VertexID = column + row * projectedColumns;
+// rows run from NDC y projectorRows.x to projectorRows.y
+uniform mat4 projector;         // inverse of P * V * M
+uniform vec3 projectorRows;     // and .z the farthest a vertex goes from the camera
+uniform int projectedColumns;
+uniform int projectedRows;
+uniform float projectedLevel;   // height of the plane, in model space
+
+// How far the wave has moved the surface; defined by the shader
+vec3 waveOffset();
+#endif
+
+// (i, j)
+vec2 gridIndex() {
+#if GRID_FORMAT == 1
+    return vgrid;
+#elif GRID_FORMAT == 3
+    vec2 local = vec2(gl_VertexID % tileVertices, gl_VertexID / tileVertices);
+    return min(vtile + local, vec2(gridN - 1));
+#elif GRID_FORMAT == 4
+    vec2 cell = vec2(gl_VertexID % projectedColumns, gl_VertexID / projectedColumns);
+    vec2 ndc = vec2(mix(-1.0, 1.0, cell.x / float(projectedColumns - 1)),
+                    mix(projectorRows.x, projectorRows.y, cell.y / float(projectedRows - 1)));
+    vec4 nearPoint = projector * vec4(ndc, -1.0, 1.0);
+    vec4 farPoint = projector * vec4(ndc, 1.0, 1.0);
+    vec3 from = nearPoint.xyz / nearPoint.w;
+    vec3 ray = farPoint.xyz / farPoint.w - from;
+
+    // Rays just past the horizon go out level with it; nothing beyond the
+    // farthest distance
+    float t = ray.z != 0.0 ? (projectedLevel - from.z) / ray.z : -1.0;
+    vec2 p = t >= 0.0 ? from.xy + t * ray.xy : from.xy + 1e6 * ray.xy;
+    float reach = length(p - from.xy);
+    if (reach > projectorRows.z) p = from.xy + (p - from.xy) * (projectorRows.z / reach);
+
+    // Less the wave, which the shader adds back to the position
+    p -= waveOffset().xy;
+    return vec2(p.y + gridSize / 2, p.x + gridSize / 2) / gridSize * float(gridN);
+#else
+    return vec2(gl_VertexID % gridN, gl_VertexID / gridN);
+#endif
+}
+
+vec3 gridPosition() {
+#if GRID_FORMAT == 0
+    return vposition;
+#else
+    vec2 ij = gridIndex();
+    float n = float(gridN);
+    return vec3(-gridSize / 2 + ij.y / n * gridSize, -gridSize / 2 + ij.x / n * gridSize, 0.0);
+#endif
+}
+
+vec2 gridUV() {
+#if GRID_FORMAT == 0
+    return vtexcoord;
+#else
+    return gridIndex() / float(gridN - 1);
+#endif
+}
+)"
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "parallel.h"
+
+// CPU view of the 5x5 patch: the heightmap in world units plus a min/max
+// pyramid over its cells, for ray casting (picking, line of sight, camera
+// probes) without reading anything back from the GPU.
+//
+// The surface is the bilinear interpolation of the samples. Sample (i, j),
+// stored at [i + j * width] like the textures, lies at world
+// x = x0 + j * cellSize, y = y0 + i * cellSize, z = (h + 1) * 0.6, the height
+// terrain_vshader computes.
+
+struct TerrainRay {
+    Vec3 origin;
+    Vec3 direction;     // need not be normalised; distances are in its units
+    float maxDistance;
+};
+
+struct TerrainHit {
+    bool hit;
+    float distance;     // ray parameter of the hit
+    Vec3 point;
+};
+
+class HeightPyramid {
+public:
+
+    HeightPyramid(const float *samples, const int width, const int height,
+                  const float x0=-2.5f, const float y0=-2.5f, const float cellSize=5.0f / 2048.0f)
+        : width(width), height(height), x0(x0), y0(y0), cellSize(cellSize) {
+
+        heights.resize(width * height);
+        for (int k = 0; k < width * height; ++k) {
+            heights[k] = (samples[k] + 1.0f) * 0.6f;
+        }
+
+        // Level 0 bounds each cell (2x2 samples), so it bounds the bilinear patch
+        int cw = width - 1, ch = height - 1;
+        std::vector<Bounds> level(cw * ch);
+        noisePool().parallelFor(ch, [&](int rowBegin, int rowEnd) {
+            for (int b = rowBegin; b < rowEnd; ++b) {
+                for (int a = 0; a < cw; ++a) {
+                    const float *h = &heights[a + b * width];
+                    float lo = std::min(std::min(h[0], h[1]), std::min(h[width], h[width + 1]));
+                    float hi = std::max(std::max(h[0], h[1]), std::max(h[width], h[width + 1]));
+                    level[a + b * cw] = Bounds{ lo, hi };
+                }
+            }
+        }, 64);
+        levelWidth.push_back(cw);
+        levelHeight.push_back(ch);
+        pyramid.push_back(std::move(level));
+
+        // Each coarser level bounds 2x2 nodes of the one below, down to one node
+        while (cw > 1 || ch > 1) {
+            int pw = (cw + 1) / 2, ph = (ch + 1) / 2;
+            const std::vector<Bounds> &fine = pyramid.back();
+            std::vector<Bounds> coarse(pw * ph);
+            for (int b = 0; b < ph; ++b) {
+                for (int a = 0; a < pw; ++a) {
+                    Bounds n = { std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+                    for (int c = 0; c < 4; ++c) {
+                        int fa = 2 * a + (c & 1), fb = 2 * b + (c >> 1);
+                        if (fa >= cw || fb >= ch) continue;
+                        n.lo = std::min(n.lo, fine[fa + fb * cw].lo);
+                        n.hi = std::max(n.hi, fine[fa + fb * cw].hi);
+                    }
+                    coarse[a + b * pw] = n;
+                }
+            }
+            cw = pw;
+            ch = ph;
+            levelWidth.push_back(cw);
+            levelHeight.push_back(ch);
+            pyramid.push_back(std::move(coarse));
+        }
+    }
+
+    int levels() const { return (int) pyramid.size(); }
+
+    size_t bytes() const {
+        size_t total = heights.size() * sizeof(float);
+        for (size_t l = 0; l < pyramid.size(); ++l) total += pyramid[l].size() * sizeof(Bounds);
+        return total;
+    }
+
+    // Terrain height under (x, y), clamped to the edge of the map
+    float heightAt(const float x, const float y) const {
+        float gi = std::min(std::max((y - y0) / cellSize, 0.0f), (float)(width - 1));
+        float gj = std::min(std::max((x - x0) / cellSize, 0.0f), (float)(height - 1));
+        int a = std::min((int) gi, width - 2);
+        int b = std::min((int) gj, height - 2);
+        float u = gi - a, v = gj - b;
+        const float *h = &heights[a + b * width];
+        return (h[0] * (1 - u) + h[1] * u) * (1 - v) + (h[width] * (1 - u) + h[width + 1] * u) * v;
+    }
+
+    // First point where origin + t * direction, 0 <= t <= maxDistance, meets the terrain
+    TerrainHit intersect(const Vec3 &origin, const Vec3 &direction,
+                         const float maxDistance=std::numeric_limits<float>::infinity()) const {
+        TerrainHit result = { false, maxDistance, origin };
+
+        // Grid coordinates: column i follows world y, row j follows world x
+        float o[3] = { (origin[1] - y0) / cellSize, (origin[0] - x0) / cellSize, origin[2] };
+        float d[3] = { direction[1] / cellSize, direction[0] / cellSize, direction[2] };
+        float inv[3];
+        for (int k = 0; k < 3; ++k) {
+            inv[k] = d[k] != 0.0f ? 1.0f / d[k] : std::numeric_limits<float>::infinity();
+        }
+
+        // Children in the order the ray crosses them
+        int first = (d[0] < 0 ? 1 : 0) | (d[1] < 0 ? 2 : 0);
+        int order[4] = { first, first ^ 1, first ^ 2, first ^ 3 };
+
+        struct Node { int level, a, b; };
+        Node stack[4 * 32];
+        int top = 0;
+        stack[top++] = Node{ levels() - 1, 0, 0 };
+
+        while (top > 0) {
+            Node n = stack[--top];
+            const Bounds &bounds = pyramid[n.level][n.a + n.b * levelWidth[n.level]];
+
+            // Slab test against the node's column: the ground is solid below the
+            // surface, so the box reaches down indefinitely
+            int span = 1 << n.level;
+            float lo[3] = { (float)(n.a * span), (float)(n.b * span), -std::numeric_limits<float>::infinity() };
+            float hi[3] = { (float) std::min((n.a + 1) * span, width - 1),
+                            (float) std::min((n.b + 1) * span, height - 1), bounds.hi };
+            float tNear = 0.0f, tFar = result.distance;
+            for (int k = 0; k < 3; ++k) {
+                float t0, t1;
+                if (d[k] == 0.0f) {
+                    if (o[k] < lo[k] || o[k] > hi[k]) { tNear = 1.0f; tFar = 0.0f; break; }
+                    continue;
+                }
+                t0 = (lo[k] - o[k]) * inv[k];
+                t1 = (hi[k] - o[k]) * inv[k];
+                if (t0 > t1) std::swap(t0, t1);
+                tNear = std::max(tNear, t0);
+                tFar = std::min(tFar, t1);
+            }
+            if (tNear > tFar) continue;
+
+            // Below the lowest point of the node where the ray enters it: a hit
+            // without descending. Nodes are visited front to back, so the first
+            // hit is the nearest.
+            float t = tNear;
+            if (o[2] + tNear * d[2] <= bounds.lo || (n.level == 0 && intersectCell(n.a, n.b, o, d, tNear, tFar, t))) {
+                result.hit = true;
+                result.distance = t;
+                result.point = origin + t * direction;
+                return result;
+            }
+            if (n.level == 0) continue;
+
+            // Push in reverse so the nearest child is popped first
+            for (int c = 3; c >= 0; --c) {
+                int ca = 2 * n.a + (order[c] & 1), cb = 2 * n.b + (order[c] >> 1);
+                if (ca < levelWidth[n.level - 1] && cb < levelHeight[n.level - 1]) {
+                    stack[top++] = Node{ n.level - 1, ca, cb };
+                }
+            }
+        }
+        return result;
+    }
+
+    TerrainHit intersect(const TerrainRay &ray) const {
+        return intersect(ray.origin, ray.direction, ray.maxDistance);
+    }
+
+    // Answers count rays on the worker pool
+    void intersect(const TerrainRay *rays, TerrainHit *hits, const int count) const {
+        noisePool().parallelFor(count, [&](int begin, int end) {
+            for (int r = begin; r < end; ++r) {
+                hits[r] = intersect(rays[r]);
+            }
+        }, 256);
+    }
+
+    // True if nothing of the terrain lies between the two points
+    bool lineOfSight(const Vec3 &from, const Vec3 &to) const {
+        return !intersect(from, to - from, 1.0f).hit;
+    }
+
+    // World heights (z) of the samples, laid out like them
+    const float *worldHeights() const { return heights.data(); }
+
+    // Nodes of pyramid level l along i and j; node (a, b) bounds cells
+    // [a * 2^l, (a + 1) * 2^l) x [b * 2^l, (b + 1) * 2^l), clipped to the map
+    int nodesI(const int l) const { return levelWidth[l]; }
+    int nodesJ(const int l) const { return levelHeight[l]; }
+
+    // Lowest and highest world height under node (a, b) of level l
+    void nodeBounds(const int l, const int a, const int b, float &lo, float &hi) const {
+        const Bounds &bounds = pyramid[l][a + b * levelWidth[l]];
+        lo = bounds.lo;
+        hi = bounds.hi;
+    }
+
+    const int width;
+    const int height;
+    const float x0, y0, cellSize;
+
+private:
+
+    struct Bounds {
+        float lo, hi;
+    };
+
+    // Smallest t in [tNear, tFar] where the ray meets the bilinear patch of
+    // cell (a, b): z(t) - h(u(t), v(t)) is a quadratic in t
+    bool intersectCell(int a, int b, const float *o, const float *d, float tNear, float tFar, float &t) const {
+        const float *h = &heights[a + b * width];
+        float h00 = h[0], h10 = h[1], h01 = h[width], h11 = h[width + 1];
+        float ca = h10 - h00, cb = h01 - h00, cc = h00 - h10 - h01 + h11;
+
+        float u0 = o[0] - a, v0 = o[1] - b;
+        float f0 = o[2] - (h00 + ca * u0 + cb * v0 + cc * u0 * v0);
+        float f1 = d[2] - (ca * d[0] + cb * d[1] + cc * (u0 * d[1] + v0 * d[0]));
+        float f2 = -cc * d[0] * d[1];
+
+        // Ray already under the surface where it enters the cell
+        if (f0 + tNear * (f1 + tNear * f2) <= 0.0f) {
+            t = tNear;
+            return true;
+        }
+
+        float roots[2];
+        int count = 0;
+        if (std::abs(f2) < 1e-12f) {
+            if (f1 != 0.0f) roots[count++] = -f0 / f1;
+        } else {
+            float disc = f1 * f1 - 4.0f * f2 * f0;
+            if (disc < 0.0f) return false;
+            // Numerically stable pair of roots
+            float q = -0.5f * (f1 + (f1 < 0 ? -std::sqrt(disc) : std::sqrt(disc)));
+            roots[count++] = q / f2;
+            if (q != 0.0f) roots[count++] = f0 / q;
+        }
+
+        bool found = false;
+        for (int k = 0; k < count; ++k) {
+            if (roots[k] >= tNear && roots[k] <= tFar && (!found || roots[k] < t)) {
+                t = roots[k];
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    std::vector<float> heights;
+    std::vector<std::vector<Bounds>> pyramid;
+    std::vector<int> levelWidth, levelHeight;
+};
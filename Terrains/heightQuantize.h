@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <OpenGP/GL/Application.h>
+#include "parallel.h"
+
+using namespace OpenGP;
+
+// Storage formats of a heightmap, shared by the CPU copy, the cache files
+// and the GPU texture. Values are written into the cache file header.
+enum class HeightmapFormat : uint32_t {
+    R32F = 1,       // float, exact
+    R16Unorm = 2,   // unorm16 with a per-map scale and offset: h = q * scale + offset
+    R16F = 3        // half float
+};
+
+inline size_t heightmapFormatSize(HeightmapFormat format) {
+    return format == HeightmapFormat::R32F ? sizeof(float) : sizeof(uint16_t);
+}
+
+inline const char *heightmapFormatName(HeightmapFormat format) {
+    switch (format) {
+        case HeightmapFormat::R16Unorm: return "unorm16";
+        case HeightmapFormat::R16F: return "half";
+        default: return "float";
+    }
+}
+
+inline bool parseHeightmapFormat(const std::string &name, HeightmapFormat &format) {
+    if (name == "float") format = HeightmapFormat::R32F;
+    else if (name == "unorm16") format = HeightmapFormat::R16Unorm;
+    else if (name == "half") format = HeightmapFormat::R16F;
+    else return false;
+    return true;
+}
+
+// IEEE 754 binary16, round to nearest even; out-of-range values saturate to infinity
+inline uint16_t floatToHalf(float value) {
+    uint32_t f;
+    std::memcpy(&f, &value, 4);
+    uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t abs = f & 0x7FFFFFFF;
+
+    if (abs >= 0x7F800000) {
+        // Inf or NaN (keeps NaN a NaN)
+        return (uint16_t)(sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0));
+    }
+    if (abs >= 0x477FF000) {
+        // Rounds to a value beyond the largest half
+        return (uint16_t)(sign | 0x7C00);
+    }
+    if (abs < 0x38800000) {
+        // Subnormal half (or zero): shift the implicit-one mantissa into place
+        if (abs < 0x33000000) return (uint16_t) sign;
+        uint32_t mantissa = (abs & 0x7FFFFF) | 0x800000;
+        int shift = 126 - (int)(abs >> 23);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) ++half;
+        return (uint16_t)(sign | half);
+    }
+
+    // Normal: rebias the exponent and round the mantissa to 10 bits
+    uint32_t half = ((abs - 0x38000000) >> 13);
+    uint32_t rest = abs & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+    return (uint16_t)(sign | half);
+}
+
+inline float halfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+    uint32_t f;
+
+    if (exponent == 0x1F) {
+        f = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa != 0) {
+        // Subnormal: normalise
+        exponent = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        f = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    } else {
+        f = sign;
+    }
+
+    float value;
+    std::memcpy(&value, &f, 4);
+    return value;
+}
+
+// A heightmap in one of the storage formats, with what the shaders need to
+// decode it and the largest error quantisation introduced
+struct QuantizedHeightmap {
+    HeightmapFormat format = HeightmapFormat::R32F;
+    int width = 0;
+    int height = 0;
+    float scale = 1.0f;     // unorm16 only: h = q * scale + offset for the stored integer q
+    float offset = 0.0f;
+    float maxError = 0.0f;  // max |decoded - original|, in heightmap units
+    std::vector<unsigned char> bytes;
+
+    const void *data() const { return bytes.data(); }
+
+    float sample(const size_t k) const {
+        uint16_t q;
+        switch (format) {
+            case HeightmapFormat::R16Unorm:
+                std::memcpy(&q, &bytes[2 * k], 2);
+                return q * scale + offset;
+            case HeightmapFormat::R16F:
+                std::memcpy(&q, &bytes[2 * k], 2);
+                return halfToFloat(q);
+            default: {
+                float h;
+                std::memcpy(&h, &bytes[4 * k], 4);
+                return h;
+            }
+        }
+    }
+
+    std::vector<float> decode() const {
+        std::vector<float> heights((size_t) width * height);
+        for (size_t k = 0; k < heights.size(); ++k) {
+            heights[k] = sample(k);
+        }
+        return heights;
+    }
+
+    // What the shaders multiply and add to a texel to get the height back.
+    // A unorm16 texel arrives as q / 65535.
+    float shaderScale() const {
+        return format == HeightmapFormat::R16Unorm ? scale * 65535.0f : 1.0f;
+    }
+
+    float shaderOffset() const {
+        return format == HeightmapFormat::R16Unorm ? offset : 0.0f;
+    }
+};
+
+// Stores samples in format and measures the error that costs
+inline QuantizedHeightmap quantizeHeightmap(const float *samples, const int width, const int height,
+                                            HeightmapFormat format) {
+    QuantizedHeightmap q;
+    q.format = format;
+    q.width = width;
+    q.height = height;
+    const size_t count = (size_t) width * height;
+    q.bytes.resize(count * heightmapFormatSize(format));
+
+    if (format == HeightmapFormat::R32F) {
+        std::memcpy(q.bytes.data(), samples, count * sizeof(float));
+        return q;
+    }
+
+    // Per-map range for unorm16; the error bound is half a step
+    if (format == HeightmapFormat::R16Unorm) {
+        float lo = samples[0], hi = samples[0];
+        for (size_t k = 1; k < count; ++k) {
+            lo = std::min(lo, samples[k]);
+            hi = std::max(hi, samples[k]);
+        }
+        q.offset = lo;
+        q.scale = hi > lo ? (hi - lo) / 65535.0f : 1.0f;
+    }
+
+    std::vector<float> rowError(height, 0.0f);
+    uint16_t *out = (uint16_t *) q.bytes.data();
+    noisePool().parallelFor(height, [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++j) {
+            float error = 0.0f;
+            for (int i = 0; i < width; ++i) {
+                size_t k = (size_t) j * width + i;
+                float decoded;
+                if (format == HeightmapFormat::R16Unorm) {
+                    float level = std::floor((samples[k] - q.offset) / q.scale + 0.5f);
+                    out[k] = (uint16_t) std::min(std::max(level, 0.0f), 65535.0f);
+                    decoded = out[k] * q.scale + q.offset;
+                } else {
+                    out[k] = floatToHalf(samples[k]);
+                    decoded = halfToFloat(out[k]);
+                }
+                error = std::max(error, std::abs(decoded - samples[k]));
+            }
+            rowError[j] = error;
+        }
+    });
+    q.maxError = *std::max_element(rowError.begin(), rowError.end());
+    return q;
+}
+
+using R16Texture = Texture<GL_R16, GL_RED, GL_UNSIGNED_SHORT>;
+using R16FTexture = Texture<GL_R16F, GL_RED, GL_HALF_FLOAT>;
+
+// Texture holding samples of the given format, uploaded as they are
+inline GenericTexture* uploadHeightmapTexture(HeightmapFormat format, const int width, const int height, const void *data) {
+    // 16-bit rows are only 2-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, format == HeightmapFormat::R32F ? 4 : 2);
+
+    GenericTexture *tex;
+    if (format == HeightmapFormat::R16Unorm) {
+        R16Texture *t = new R16Texture();
+        t->upload_raw(width, height, data);
+        tex = t;
+    } else if (format == HeightmapFormat::R16F) {
+        R16FTexture *t = new R16FTexture();
+        t->upload_raw(width, height, data);
+        tex = t;
+    } else {
+        R32FTexture *t = new R32FTexture();
+        t->upload_raw(width, height, data);
+        tex = t;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return tex;
+}
+
+inline GenericTexture* uploadHeightmapTexture(const QuantizedHeightmap &heightmap) {
+    return uploadHeightmapTexture(heightmap.format, heightmap.width, heightmap.height, heightmap.data());
+}
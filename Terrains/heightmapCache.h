@@ -0,0 +1,352 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "fractalPresets.h"
+#include "heightQuantize.h"
+#include "erosion.h"
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <direct.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// On-disk heightmap cache. A file holds one heightmap behind a fixed header;
+// its name and header carry a hash of everything that produced the samples,
+// so a file is only used when generating again would give the same values.
+// Files are written in the byte order of the machine that generates them
+// (little-endian on every platform this project targets).
+
+// Bump when any generator changes its output for the same parameters
+// 2: noise graphs sampled in map units
+const uint32_t heightmapGeneratorVersion = 2;
+
+// 2: 16-bit formats, with the unorm16 decode range in the header
+const uint32_t heightmapFileVersion = 2;
+
+struct HeightmapFileHeader {
+    char magic[8];          // "TERRHMAP"
+    uint32_t version;       // heightmapFileVersion
+    uint32_t format;        // HeightmapFormat
+    uint32_t width;
+    uint32_t height;
+    uint64_t key;           // heightmapKey of the generator and its inputs
+    uint64_t dataOffset;    // from the start of the file; samples are 16-byte aligned
+    uint64_t dataSize;      // bytes
+    float scale;            // QuantizedHeightmap scale, offset and maxError
+    float offset;
+    float maxError;
+    uint32_t reserved;
+};
+
+// 64-bit FNV-1a, fed field by field
+class Fnv1a {
+public:
+    Fnv1a &add(const void *data, size_t size) {
+        const unsigned char *bytes = (const unsigned char *) data;
+        for (size_t k = 0; k < size; ++k) {
+            hash = (hash ^ bytes[k]) * 0x100000001B3ull;
+        }
+        return *this;
+    }
+
+    template <typename T>
+    Fnv1a &add(const T &value) {
+        return add(&value, sizeof(T));
+    }
+
+    Fnv1a &add(const std::string &text) {
+        uint64_t size = text.size();
+        return add(size).add(text.data(), text.size());
+    }
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+};
+
+// Identifies the samples fractalPresetTexture would produce, eroded and
+// stored in format
+inline uint64_t heightmapKey(const FractalPreset &preset, const uint64_t seed,
+                             const int width, const int height, const int period,
+                             HeightmapFormat format=HeightmapFormat::R32F,
+                             const ErosionParams &erosion=ErosionParams()) {
+    Fnv1a h;
+    h.add(heightmapGeneratorVersion).add(std::string(preset.hybrid ? "hybrid-multifractal" : "fbm"));
+    h.add(preset.name).add(preset.cubicFade);
+    h.add(preset.params.H).add(preset.params.lacunarity).add(preset.params.offset).add(preset.params.octaves);
+    h.add(seed).add(width).add(height).add(period).add((uint32_t) format);
+    if (preset.basis != NoiseBasis::Perlin) {
+        h.add(std::string(noiseBasisName(preset.basis)));
+    }
+    if (erosion.enabled()) {
+        h.add(erosion.hydraulicIterations).add(erosion.thermalIterations);
+        h.add(erosion.timeStep).add(erosion.rain).add(erosion.gravity).add(erosion.capacity);
+        h.add(erosion.dissolving).add(erosion.depositing).add(erosion.evaporation).add(erosion.minSlope);
+        h.add(erosion.maxErosionDepth).add(erosion.stillWater).add(erosion.talus).add(erosion.thermalRate);
+    }
+    return h.hash;
+}
+
+// Read-only view of a whole file, mapped into memory
+class MappedFile {
+public:
+
+    explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return;
+        void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!view) return;
+        bytes = (const unsigned char *) view;
+        length = (size_t) fileSize.QuadPart;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *view = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                bytes = (const unsigned char *) view;
+                length = (size_t) info.st_size;
+                // The whole file is uploaded right away
+                madvise(view, length, MADV_WILLNEED);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (bytes) munmap((void *) bytes, length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+
+    bool valid() const { return bytes != nullptr; }
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+inline void makeDirectory(const std::string &path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+// Samples of a mapped heightmap file, or nullptr if the file is missing,
+// truncated or was produced by something other than key. fileHeader, if
+// given, receives the file's header.
+inline const void *heightmapFileData(const MappedFile &file, const uint64_t key, HeightmapFormat format,
+                                     const int width, const int height, HeightmapFileHeader *fileHeader=nullptr) {
+    if (!file.valid() || file.size() < sizeof(HeightmapFileHeader)) return nullptr;
+
+    HeightmapFileHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    uint64_t expectedSize = (uint64_t) width * height * heightmapFormatSize(format);
+    if (std::memcmp(header.magic, "TERRHMAP", 8) != 0 || header.version != heightmapFileVersion ||
+        header.format != (uint32_t) format || header.width != (uint32_t) width ||
+        header.height != (uint32_t) height || header.key != key || header.dataSize != expectedSize ||
+        header.dataOffset < sizeof(header) || header.dataOffset > file.size() ||
+        header.dataSize > file.size() - header.dataOffset) {
+        return nullptr;
+    }
+    if (fileHeader) *fileHeader = header;
+    return file.data() + header.dataOffset;
+}
+
+// Writes next to the final name and renames, so an interrupted write never
+// leaves a file that looks valid
+inline bool writeHeightmapFile(const std::string &path, const uint64_t key, const QuantizedHeightmap &heightmap) {
+    const HeightmapFormat format = heightmap.format;
+    const int width = heightmap.width;
+    const int height = heightmap.height;
+    const void *data = heightmap.data();
+
+    HeightmapFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TERRHMAP", 8);
+    header.version = heightmapFileVersion;
+    header.format = (uint32_t) format;
+    header.width = (uint32_t) width;
+    header.height = (uint32_t) height;
+    header.key = key;
+    header.dataOffset = (sizeof(header) + 15) / 16 * 16;
+    header.dataSize = (uint64_t) width * height * heightmapFormatSize(format);
+    header.scale = heightmap.scale;
+    header.offset = heightmap.offset;
+    header.maxError = heightmap.maxError;
+
+    std::string temporary = path + ".tmp";
+    FILE *out = std::fopen(temporary.c_str(), "wb");
+    if (!out) return false;
+
+    static const char padding[16] = { 0 };
+    bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+              std::fwrite(padding, 1, header.dataOffset - sizeof(header), out) == header.dataOffset - sizeof(header) &&
+              std::fwrite(data, 1, (size_t) header.dataSize, out) == header.dataSize;
+    ok = std::fclose(out) == 0 && ok;
+
+    std::remove(path.c_str());
+    if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline std::string heightmapCachePath(const std::string &directory, const uint64_t key) {
+    char name[40];
+    std::snprintf(name, sizeof(name), "heightmap-%016llx.bin", (unsigned long long) key);
+    return directory + "/" + name;
+}
+
+// Spacing of the heightmap samples in height units: the 5x5 patch, with
+// z = (h + 1) * 0.6 as in terrain_vshader
+inline float patchCellSize(const int width) {
+    return 5.0f / width / 0.6f;
+}
+
+// The preset's 2048^2 heightmap, eroded and stored in format
+inline QuantizedHeightmap presetHeightmap(const FractalPreset &preset, const uint64_t seed, HeightmapFormat format,
+                                          const ErosionParams &erosion=ErosionParams()) {
+    const int width = 2048;
+    const int height = 2048;
+
+    float *noise_data = preset.generate2D(width, height, 512, seed);
+    if (erosion.enabled()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        erodeHeightmap(noise_data, width, height, patchCellSize(width), erosion);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Eroded (" << erosion.hydraulicIterations << " hydraulic, " << erosion.thermalIterations
+                  << " thermal iterations) in " << ms << " ms" << std::endl;
+    }
+    QuantizedHeightmap heightmap = quantizeHeightmap(noise_data, width, height, format);
+    delete[] noise_data;
+    return heightmap;
+}
+
+// Copy of a cache file's samples, as validated by heightmapFileData
+inline void copyHeightmapFile(const HeightmapFileHeader &header, const void *data, QuantizedHeightmap &heights) {
+    heights.format = (HeightmapFormat) header.format;
+    heights.width = (int) header.width;
+    heights.height = (int) header.height;
+    heights.scale = header.scale;
+    heights.offset = header.offset;
+    heights.maxError = header.maxError;
+    const unsigned char *bytes = (const unsigned char *) data;
+    heights.bytes.assign(bytes, bytes + header.dataSize);
+}
+
+// Saves a heightmap generated in ms to the cache and reports the cold start
+inline void storeCachedHeightmap(const std::string &directory, const std::string &path, const uint64_t key,
+                                 const QuantizedHeightmap &heightmap, const double ms) {
+    makeDirectory(directory);
+    bool written = writeHeightmapFile(path, key, heightmap);
+
+    std::cout << "Heightmap cache miss (cold start): generated in " << ms << " ms";
+    if (written) std::cout << ", saved to " << path;
+    else std::cout << ", could not write " << path;
+    std::cout << std::endl;
+}
+
+// presetHeightmap backed by the cache in directory, uploaded to a texture of
+// the same format: a hit maps the file and uploads straight from the mapping,
+// a miss generates and writes the file. Prints which path was taken and how
+// long it took (cold vs warm start). heights, if given, receives the CPU copy.
+GenericTexture* cachedPresetTexture(const FractalPreset &preset, const uint64_t seed, const std::string &directory,
+                                    HeightmapFormat format=HeightmapFormat::R32F, QuantizedHeightmap *heights=nullptr,
+                                    const ErosionParams &erosion=ErosionParams()) {
+    const int width = 2048;
+    const int height = 2048;
+    const int period = 512;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t key = heightmapKey(preset, seed, width, height, period, format, erosion);
+    std::string path = heightmapCachePath(directory, key);
+
+    {
+        MappedFile file(path);
+        HeightmapFileHeader header;
+        const void *data = heightmapFileData(file, key, format, width, height, &header);
+        if (data) {
+            GenericTexture* _tex = uploadHeightmapTexture(format, width, height, data);
+            if (heights) copyHeightmapFile(header, data, *heights);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Heightmap cache hit (warm start): mapped " << path << " in " << ms << " ms" << std::endl;
+            return _tex;
+        }
+    }
+
+    QuantizedHeightmap heightmap = presetHeightmap(preset, seed, format, erosion);
+    GenericTexture* _tex = uploadHeightmapTexture(heightmap);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    storeCachedHeightmap(directory, path, key, heightmap, ms);
+
+    if (heights) *heights = std::move(heightmap);
+    return _tex;
+}
+
+// The two halves of cachedPresetTexture without GL, for callers off the main
+// thread. loadCachedHeightmap fills heights from a valid cache file, if any;
+// generateCachedHeightmap runs presetHeightmap and writes the file.
+inline bool loadCachedHeightmap(const FractalPreset &preset, const uint64_t seed, const std::string &directory,
+                                HeightmapFormat format, const ErosionParams &erosion, QuantizedHeightmap &heights) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t key = heightmapKey(preset, seed, 2048, 2048, 512, format, erosion);
+    std::string path = heightmapCachePath(directory, key);
+
+    MappedFile file(path);
+    HeightmapFileHeader header;
+    const void *data = heightmapFileData(file, key, format, 2048, 2048, &header);
+    if (!data) return false;
+    copyHeightmapFile(header, data, heights);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Heightmap cache hit (warm start): mapped " << path << " in " << ms << " ms" << std::endl;
+    return true;
+}
+
+inline QuantizedHeightmap generateCachedHeightmap(const FractalPreset &preset, const uint64_t seed,
+                                                  const std::string &directory, HeightmapFormat format,
+                                                  const ErosionParams &erosion) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t key = heightmapKey(preset, seed, 2048, 2048, 512, format, erosion);
+
+    QuantizedHeightmap heightmap = presetHeightmap(preset, seed, format, erosion);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    storeCachedHeightmap(directory, heightmapCachePath(directory, key), key, heightmap, ms);
+    return heightmap;
+}
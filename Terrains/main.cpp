@@ -1,8 +1,24 @@
 #include <OpenGP/GL/Application.h>
 #include "OpenGP/GL/Eigen.h"
+#include <sstream>
 
 #include "loadTexture.h"
 #include "noise.h"
+#include "fractalPresets.h"
+#include "terrainTiles.h"
+#include "heightmapCache.h"
+#include "octaveLayers.h"
+#include "heightPyramid.h"
+#include "erosion.h"
+#include "normalMap.h"
+#include "progressiveHeightmap.h"
+#include "grid.h"
+#include "clipmap.h"
+#include "cdlod.h"
+#include "rtin.h"
+#include "waterTiles.h"
+#include "terrainLod.h"
+#include "projectedGrid.h"
 
 using namespace OpenGP;
 const int width=1280, height=720;
@@ -21,6 +37,18 @@ const char* terrain_fshader =
 #include "terrain_fshader.glsl"
 ;
 
+const char* tile_vshader =
+#include "tile_vshader.glsl"
+;
+
+const char* clipmap_vshader =
+#include "clipmap_vshader.glsl"
+;
+
+const char* cdlod_vshader =
+#include "cdlod_vshader.glsl"
+;
+
 const char* water_vshader =
 #include "water_vshader.glsl"
 ;
@@ -35,7 +63,28 @@ const char* water2_fshader =
 #include "water2_fshader.glsl"
 ;
 
-const unsigned resPrim = 999999;
+// Prepended to the vertex shaders drawn on the shared grid (gridVertexShader)
+const char* grid_vertex =
+#include "grid_vertex.glsl"
+;
+
+// Ends a triangle strip; above every vertex index a grid can have
+const unsigned resPrim = 0xFFFFFFFFu;
+
+// The grid shared by the terrain and water: resolution, extent in world
+// units, and each surface's height on it ("zOffset")
+const int gridResolution = 1024;
+const float gridExtent = 5.0f;
+const float terrainZOffset = 0.0f;
+const float waterZOffset = 0.57f;
+
+// Quads on a side of the water tiles drawn over low ground (waterTiles.h)
+const int waterTileQuads = 32;
+
+// Vertices of the projected water grid (projectedGrid.h): one per 4x4 pixels
+const int projectedWaterColumns = width / 4;
+const int projectedWaterRows = height / 4;
+
 constexpr float PI = 3.14159265359f;
 
 void init();
@@ -43,8 +92,20 @@ void genTerrainMesh();
 void genWaterMesh();
 void genWater2Mesh();
 void genCubeMesh();
+void genTileMesh();
+std::string gridVertexShader(const char *source);
+std::string gridVertexShader(const char *source, GridVertexFormat format);
 void drawSkybox();
 void drawTerrain();
+void drawTiles();
+void retuneTerrain();
+void updateNormalTexture(const float *samples);
+TerrainLodSettings terrainLodSettings();
+void updateTerrainLod();
+void swapInTerrainLod(TerrainLod lod);
+void updateProgressiveHeightmap();
+void reportStartupTimes();
+Mat4x4 waterFollowCamera();
 void drawWater();
 void drawWater2();
 
@@ -54,17 +115,45 @@ std::unique_ptr<GPUMesh> skyboxMesh;
 GLuint skyboxTexture;
 
 std::unique_ptr<Shader> terrainShader;
-std::unique_ptr<GPUMesh> terrainMesh;
-std::unique_ptr<R32FTexture> heightTexture;
+std::shared_ptr<GPUMesh> terrainMesh;
+std::unique_ptr<GenericTexture> heightTexture;
+QuantizedHeightmap terrainHeights;
+std::unique_ptr<RG16SnormTexture> normalTexture;
 std::unique_ptr<R32FTexture> heightTexture2;
+std::unique_ptr<OctaveLayers> octaveLayers;
+std::unique_ptr<HeightPyramid> terrainPyramid;
+std::unique_ptr<ProgressiveHeightmap> progressiveHeightmap;
+TerrainHit pickedTerrain;
 std::map<std::string, std::unique_ptr<RGBA8Texture>> terrainTextures;
 
+std::unique_ptr<Shader> tileShader;
+std::unique_ptr<GPUMesh> tileMesh;
+std::unique_ptr<TileStreamer> tileStreamer;
+
+std::unique_ptr<Shader> clipmapShader;
+std::unique_ptr<GeometryClipmap> terrainClipmap;
+
+std::unique_ptr<Shader> cdlodShader;
+std::unique_ptr<CDLODQuadtree> terrainQuadtree;
+std::unique_ptr<CDLODRenderer> cdlodRenderer;
+std::vector<CDLODNode> cdlodSelection;
+
+std::unique_ptr<Shader> rtinShader;
+std::unique_ptr<RTINTerrain> terrainRTIN;
+std::unique_ptr<GPUMesh> rtinMesh;
+size_t rtinTriangles = 0;
+
+std::unique_ptr<WaterCoverage> waterTileCoverage;
+std::unique_ptr<ProjectedGrid> waterProjector;
+
 std::unique_ptr<Shader> waterShader;
-std::unique_ptr<GPUMesh> waterMesh;
+std::shared_ptr<GPUMesh> waterMesh;
+std::unique_ptr<WaterPatches> waterPatches;
 std::map<std::string, std::unique_ptr<RGBA8Texture>> waterTextures;
 
 std::unique_ptr<Shader> water2Shader;
-std::unique_ptr<GPUMesh> water2Mesh;
+std::shared_ptr<GPUMesh> water2Mesh;
+std::unique_ptr<WaterPatches> water2Patches;
 std::map<std::string, std::unique_ptr<RGBA8Texture>> water2Textures;
 
 
@@ -86,7 +175,133 @@ float waveMotion;
 float waveMotion2;
 float cloudMotion;
 
-int main(int, char**){
+uint64_t terrainSeed = defaultNoiseSeed;
+std::string terrainPreset = "summer";
+bool infiniteTerrain = false;
+std::string heightmapCacheDir = "heightmap_cache";
+bool useHeightmapCache = true;
+HeightmapFormat heightmapFormat = HeightmapFormat::R32F;
+ErosionParams terrainErosion;
+NoiseBasis terrainBasis = NoiseBasis::Perlin;
+FractalPreset selectedPreset;
+const FractalPreset *activePreset = nullptr;
+FractalParams tunedParams;
+bool blockingStartup = false;
+GridVertexFormat gridVertexFormat = GridVertexFormat::Full;
+GridIndexOrder gridIndexOrder = GridIndexOrder::Tiled;
+bool clipmapTerrain = false;
+bool cdlodTerrain = false;
+bool rtinTerrain = false;
+float rtinMaxError = 0.002f;
+bool rtinReport = false;
+bool fullWater = false;
+bool projectedWater = false;
+
+// Startup measurements (reportStartupTimes)
+std::chrono::steady_clock::time_point programStart;
+bool firstFrameDrawn = false;
+bool fullQualityPending = false;
+
+int main(int argc, char** argv){
+    programStart = std::chrono::steady_clock::now();
+
+    // Command line options
+    //   --threads N        worker threads for heightmap generation (0 = all cores)
+    //   --seed N           seed of the gradient lattice
+    //   --preset NAME      terrain look (summer, summer-cubic, summer-hybrid, lunar, lunar-rough, alpine)
+    //   --perlin-report    compare the scalar and SIMD perlin paths
+    //   --infinite         stream tiles around the camera instead of the 5x5 patch
+    //   --cache-dir DIR    where generated heightmaps are kept (default heightmap_cache)
+    //   --no-cache         always generate the heightmap
+    //   --height-format F  heightmap storage: float, unorm16 or half (default float)
+    //   --erosion N        hydraulic erosion iterations after generation (default 0)
+    //   --thermal N        thermal erosion iterations after that (default 0)
+    //   --basis B          noise under the 5x5 patch: perlin or simplex (default perlin)
+    //   --blocking         generate the heightmap before opening the window, not progressively
+    //   --grid-format F    grid vertices: full, compact (16-bit index pair) or none (gl_VertexID)
+    //   --grid-order O     grid index order: rows, tiled or forsyth (default tiled)
+    //   --vertex-cache-report  compare the grid index orders on a simulated vertex cache
+    //   --clipmap          draw the 5x5 patch as a geometry clipmap around the camera
+    //   --cdlod            draw the 5x5 patch as a CDLOD quadtree, culled to the view
+    //   --rtin E           draw the 5x5 patch as one adaptive mesh within E world units of the heights
+    //   --rtin-report      adaptive mesh sizes at a range of errors, for each heightmap
+    //   --full-water       draw the whole water sheets, not only the tiles over low ground
+    //   --projected-water  draw the water as a screen-space grid projected onto an endless plane
+    bool perlinReport = false;
+    bool vertexCacheReport = false;
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc) {
+            setNoiseThreads(std::atoi(argv[++a]));
+        } else if (arg == "--seed" && a + 1 < argc) {
+            terrainSeed = std::strtoull(argv[++a], nullptr, 0);
+        } else if (arg == "--preset" && a + 1 < argc) {
+            terrainPreset = argv[++a];
+        } else if (arg == "--perlin-report") {
+            perlinReport = true;
+        } else if (arg == "--infinite") {
+            infiniteTerrain = true;
+        } else if (arg == "--cache-dir" && a + 1 < argc) {
+            heightmapCacheDir = argv[++a];
+        } else if (arg == "--no-cache") {
+            useHeightmapCache = false;
+        } else if (arg == "--height-format" && a + 1 < argc) {
+            if (!parseHeightmapFormat(argv[++a], heightmapFormat)) {
+                std::cout << "Unknown height format " << argv[a] << ", using float" << std::endl;
+            }
+        } else if (arg == "--erosion" && a + 1 < argc) {
+            terrainErosion.hydraulicIterations = std::atoi(argv[++a]);
+        } else if (arg == "--thermal" && a + 1 < argc) {
+            terrainErosion.thermalIterations = std::atoi(argv[++a]);
+        } else if (arg == "--basis" && a + 1 < argc) {
+            if (!parseNoiseBasis(argv[++a], terrainBasis)) {
+                std::cout << "Unknown noise basis " << argv[a] << ", using perlin" << std::endl;
+            }
+        } else if (arg == "--blocking") {
+            blockingStartup = true;
+        } else if (arg == "--clipmap") {
+            clipmapTerrain = true;
+            cdlodTerrain = false;
+            rtinTerrain = false;
+        } else if (arg == "--cdlod") {
+            cdlodTerrain = true;
+            clipmapTerrain = false;
+            rtinTerrain = false;
+        } else if (arg == "--rtin" && a + 1 < argc) {
+            rtinTerrain = true;
+            rtinMaxError = (float) std::atof(argv[++a]);
+            clipmapTerrain = false;
+            cdlodTerrain = false;
+        } else if (arg == "--rtin-report") {
+            rtinReport = true;
+        } else if (arg == "--full-water") {
+            fullWater = true;
+        } else if (arg == "--projected-water") {
+            projectedWater = true;
+        } else if (arg == "--grid-format" && a + 1 < argc) {
+            if (!parseGridVertexFormat(argv[++a], gridVertexFormat)) {
+                std::cout << "Unknown grid format " << argv[a] << ", using full" << std::endl;
+            }
+        } else if (arg == "--grid-order" && a + 1 < argc) {
+            if (!parseGridIndexOrder(argv[++a], gridIndexOrder)) {
+                std::cout << "Unknown grid order " << argv[a] << ", using tiled" << std::endl;
+            }
+        } else if (arg == "--vertex-cache-report") {
+            vertexCacheReport = true;
+        }
+    }
+
+    // Water tiles need the fixed map's heights; the streamed terrain has none
+    if (infiniteTerrain) {
+        fullWater = true;
+    }
+
+    if (perlinReport) {
+        reportPerlinThroughput();
+    }
+    if (vertexCacheReport) {
+        reportVertexCacheOrders(gridResolution, resPrim);
+    }
 
     Application app;
 
@@ -95,6 +310,13 @@ int main(int, char**){
     genTerrainMesh();
     genWaterMesh();
     genWater2Mesh();
+    std::cout << "Grid meshes (" << gridVertexFormatName(gridVertexFormat) << " vertices, "
+              << gridIndexOrderName(gridIndexOrder) << " order): "
+              << gridMeshCache().count() << " shared, " << (gridMeshCache().bytes() >> 20)
+              << " MB (" << (gridMeshCache().unsharedBytes() >> 20) << " MB as separate meshes)" << std::endl;
+    if (infiniteTerrain) {
+        genTileMesh();
+    }
 
     // Initialize camera position and direction
     cameraPos = Vec3(0.0f, 0.0f, 3.0f);
@@ -126,11 +348,23 @@ int main(int, char**){
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        updateProgressiveHeightmap();
+
         drawSkybox();
         glClear(GL_DEPTH_BUFFER_BIT);
-        drawTerrain();
-        drawWater();
-        drawWater2();
+        if (infiniteTerrain) {
+            drawTiles();
+        } else if (heightTexture) {
+            drawTerrain();
+        }
+
+        // The water reads the fixed map, which a progressive start may not have yet
+        if (heightTexture) {
+            drawWater();
+            drawWater2();
+        }
+
+        reportStartupTimes();
     });
     window.set_title("Virtual Landscape");
     window.set_size(width, height);
@@ -159,6 +393,28 @@ int main(int, char**){
 
         cameraFront = front.normalized();
         mouse = m.position;
+
+        // Picking: the terrain point under the cursor, shown in the title bar
+        if (terrainPyramid && !infiniteTerrain) {
+            Vec3 look = cameraFront + cameraPos;
+            Mat4x4 V = lookAt(cameraPos, look, Vec3(0, 0, 1));
+            Mat4x4 P = perspective(80.0f, width / (float)height, 0.1f, 60.0f);
+            Mat4x4 inverse = (P * V).inverse();
+            float ndcX = 2.0f * m.position[0] / width - 1.0f;
+            float ndcY = 1.0f - 2.0f * m.position[1] / height;
+            Vec4 nearPoint = inverse * Vec4(ndcX, ndcY, -1.0f, 1.0f);
+            Vec4 farPoint = inverse * Vec4(ndcX, ndcY, 1.0f, 1.0f);
+            Vec3 from = nearPoint.head<3>() / nearPoint[3];
+            Vec3 to = farPoint.head<3>() / farPoint[3];
+
+            pickedTerrain = terrainPyramid->intersect(from, to - from, 1.0f);
+            std::ostringstream title;
+            title << "Virtual Landscape";
+            if (pickedTerrain.hit) {
+                title << " - " << pickedTerrain.point[0] << ", " << pickedTerrain.point[1] << ", " << pickedTerrain.point[2];
+            }
+            window.set_title(title.str());
+        }
     });
 
     // TODO: Key event listener: Handle keyboard input (moving around the screen)
@@ -217,10 +473,63 @@ int main(int, char**){
             speed -= speedIncrement;
             if (speed <= 0.01f) speed = 0.01f;
         }
+
+        // Camera probe: stay above the ground of the 5x5 patch
+        if (terrainPyramid && !infiniteTerrain) {
+            float ground = terrainPyramid->heightAt(cameraPos[0], cameraPos[1]);
+            cameraPos[2] = std::max(cameraPos[2], ground + 0.05f);
+        }
+
+        // Tune H (1/2), offset (3/4) and octave count (5/6) of the 5x5 patch
+        // (not while the startup heightmap is still generating on the shared pool)
+        if (!k.released && k.key >= GLFW_KEY_1 && k.key <= GLFW_KEY_6) {
+            if (progressiveHeightmap) {
+                std::cout << "Heightmap still generating, try again when it reaches full quality" << std::endl;
+                return;
+            }
+            if (k.key == GLFW_KEY_1) tunedParams.H = std::max(0.0f, tunedParams.H - 0.05f);
+            if (k.key == GLFW_KEY_2) tunedParams.H += 0.05f;
+            if (k.key == GLFW_KEY_3) tunedParams.offset -= 0.05f;
+            if (k.key == GLFW_KEY_4) tunedParams.offset += 0.05f;
+            if (k.key == GLFW_KEY_5) tunedParams.octaves = std::max(1, tunedParams.octaves - 1);
+            if (k.key == GLFW_KEY_6) tunedParams.octaves += 1;
+            retuneTerrain();
+        }
+
+        // Tile cache, clipmap and quadtree statistics
+        if (k.key == GLFW_KEY_I && !k.released && tileStreamer) {
+            tileStreamer->printStatistics();
+        }
+        if (k.key == GLFW_KEY_I && !k.released && terrainClipmap) {
+            std::cout << "Clipmap: " << terrainClipmap->levelCount() << " levels, "
+                      << terrainClipmap->trianglesDrawn() << " triangles last frame" << std::endl;
+        }
+        if (k.key == GLFW_KEY_I && !k.released && cdlodRenderer) {
+            std::cout << "CDLOD: " << terrainQuadtree->levelCount() << " levels, " << cdlodSelection.size()
+                      << " nodes, " << cdlodRenderer->trianglesDrawn() << " triangles last frame" << std::endl;
+        }
+        if (k.key == GLFW_KEY_I && !k.released && rtinMesh) {
+            std::cout << "RTIN: " << rtinTriangles << " triangles within " << rtinMaxError << " of the heights ("
+                      << 100.0 * rtinTriangles / (2.0 * (gridResolution - 1) * (gridResolution - 1))
+                      << "% of the grid)" << std::endl;
+        }
+        if (k.key == GLFW_KEY_I && !k.released && waterProjector) {
+            std::cout << "Water: projected grid of " << waterProjector->vertexCount() << " vertices, "
+                      << (waterProjector->drawnLastFrame() ? "in view" : "out of view") << std::endl;
+        }
+        if (k.key == GLFW_KEY_I && !k.released && waterPatches) {
+            std::cout << "Water: " << waterPatches->tilesDrawn() << " and " << water2Patches->tilesDrawn() << " of "
+                      << waterPatches->tileCount() << " tiles last frame" << std::endl;
+        }
        
     });
 
-    return app.run();
+    int status = app.run();
+
+    // Closed during startup: stop the generator while the shared pool it runs
+    // on still exists (it finishes the level in progress first)
+    progressiveHeightmap.reset();
+    return status;
 }
 
 void init(){
@@ -243,29 +552,102 @@ void init(){
     // Complile terrain shader
     terrainShader = std::unique_ptr<Shader>(new Shader());
     terrainShader->verbose = true;
-    terrainShader->add_vshader_from_source(terrain_vshader);
+    terrainShader->add_vshader_from_source(gridVertexShader(terrain_vshader).c_str());
     terrainShader->add_fshader_from_source(terrain_fshader);
     terrainShader->link();
 
-    // Complile water shader
+    // Complile water shader; for tiles, on their patch instances, or on the
+    // projected grid
+    GridVertexFormat waterVertexFormat = projectedWater ? GridVertexFormat::Projected
+                                       : fullWater ? gridVertexFormat : GridVertexFormat::Instanced;
     waterShader = std::unique_ptr<Shader>(new Shader());
     waterShader->verbose = true;
-    waterShader->add_vshader_from_source(water_vshader);
+    waterShader->add_vshader_from_source(gridVertexShader(water_vshader, waterVertexFormat).c_str());
     waterShader->add_fshader_from_source(water_fshader);
     waterShader->link();
 
     // Complile water shader2
     water2Shader = std::unique_ptr<Shader>(new Shader());
     water2Shader->verbose = true;
-    water2Shader->add_vshader_from_source(water2_vshader);
+    water2Shader->add_vshader_from_source(gridVertexShader(water2_vshader, waterVertexFormat).c_str());
     water2Shader->add_fshader_from_source(water2_fshader);
     water2Shader->link();
 
-    // Get height texture (Regular fBm)
-    heightTexture = std::unique_ptr<R32FTexture>(fBm2DTexture());
+    // Clipmap terrain: its own vertex shader, the terrain's fragment shader
+    if (clipmapTerrain) {
+        clipmapShader = std::unique_ptr<Shader>(new Shader());
+        clipmapShader->verbose = true;
+        clipmapShader->add_vshader_from_source(clipmap_vshader);
+        clipmapShader->add_fshader_from_source(terrain_fshader);
+        clipmapShader->link();
+    }
+
+    // CDLOD terrain: likewise
+    if (cdlodTerrain) {
+        cdlodShader = std::unique_ptr<Shader>(new Shader());
+        cdlodShader->verbose = true;
+        cdlodShader->add_vshader_from_source(cdlod_vshader);
+        cdlodShader->add_fshader_from_source(terrain_fshader);
+        cdlodShader->link();
+    }
+
+    // Adaptive mesh: the terrain shaders on 16-bit sample pairs
+    if (rtinTerrain) {
+        rtinShader = std::unique_ptr<Shader>(new Shader());
+        rtinShader->verbose = true;
+        rtinShader->add_vshader_from_source(gridVertexShader(terrain_vshader, GridVertexFormat::Compact).c_str());
+        rtinShader->add_fshader_from_source(terrain_fshader);
+        rtinShader->link();
+    }
+
+    // Get height texture from the selected preset (Regular fBm for "summer",
+    // Hybrid Multifractal for the *-hybrid and lunar presets)
+    const FractalPreset *preset = findFractalPreset(terrainPreset);
+    if (!preset) {
+        std::cout << "Unknown preset " << terrainPreset << ", using summer" << std::endl;
+        preset = findFractalPreset("summer");
+    }
+    selectedPreset = *preset;
+    selectedPreset.basis = terrainBasis;
+    activePreset = &selectedPreset;
+    tunedParams = preset->params;
+    if (!blockingStartup) {
+        // Generated in the background; updateProgressiveHeightmap swaps in each level
+        progressiveHeightmap = std::unique_ptr<ProgressiveHeightmap>(new ProgressiveHeightmap(
+            selectedPreset, terrainSeed, heightmapFormat, terrainErosion, useHeightmapCache ? heightmapCacheDir : "",
+            terrainLodSettings()));
+    } else {
+        if (useHeightmapCache) {
+            heightTexture = std::unique_ptr<GenericTexture>(cachedPresetTexture(selectedPreset, terrainSeed, heightmapCacheDir,
+                                                                                heightmapFormat, &terrainHeights, terrainErosion));
+        } else {
+            terrainHeights = presetHeightmap(selectedPreset, terrainSeed, heightmapFormat, terrainErosion);
+            heightTexture = std::unique_ptr<GenericTexture>(uploadHeightmapTexture(terrainHeights));
+        }
+        std::cout << "Heightmap stored as " << heightmapFormatName(heightmapFormat) << " ("
+                  << (terrainHeights.bytes.size() >> 20) << " MB), max height error " << terrainHeights.maxError << std::endl;
+
+        // CPU copy of the heights for picking and camera probes
+        std::vector<float> samples = terrainHeights.decode();
+        terrainPyramid = std::unique_ptr<HeightPyramid>(new HeightPyramid(samples.data(), terrainHeights.width, terrainHeights.height));
+        updateNormalTexture(samples.data());
+        updateTerrainLod();
+        fullQualityPending = true;
+    }
 
-    // Get height texture (Hybrid Multifractal)[Optional]
-    //heightTexture = std::unique_ptr<R32FTexture>(HybridMultifractal2DTexture());
+    // Infinite terrain: tiles of the same preset, generated in the background.
+    // Tiles come from WorldNoise's unwrapped Perlin octaves, which have no
+    // simplex variant, so they ignore --basis; graph presets stream as plain
+    // fBm with their parameters.
+    if (infiniteTerrain) {
+        tileShader = std::unique_ptr<Shader>(new Shader());
+        tileShader->verbose = true;
+        tileShader->add_vshader_from_source(tile_vshader);
+        tileShader->add_fshader_from_source(terrain_fshader);
+        tileShader->link();
+
+        tileStreamer = std::unique_ptr<TileStreamer>(new TileStreamer(*preset, terrainSeed));
+    }
     
     // Load terrain textures
     const std::string list[] = {"grass", "rock", "sand", "snow", "water", "lunar"};
@@ -322,288 +704,84 @@ void init(){
 }
 
 void genTerrainMesh() {
-    
-    // Generate a flat mesh for the terrain with given dimensions, using triangle strips
-    terrainMesh = std::unique_ptr<GPUMesh>(new GPUMesh());
-
-
-    // Grid resolution
-    int n_width = 1024;
-    int n_height = 1024;
-    //int n_width = 256;
-    //int n_height = 256;
-
-
-
-    // Grid dimensions (centered at (0, 0))
-    float f_width = 5.0f;
-    float f_height = 5.0f;
-
-
-
-    std::vector<Vec3> points;
-    std::vector<unsigned int> indices;
-    std::vector<Vec2> texCoords;
-
-
 
-    // Generate vertex and texture coordinates
-    for (int j = 0; j < n_width; ++j) {
-        for (int i = 0; i < n_height; ++i) {
-
-
-
-            // Calculate vertex positions
-            float vertX = -f_width / 2 + j / (float)n_width * f_width;
-            float vertY = -f_height / 2 + i / (float)n_height * f_height;
-            float vertZ = 0.0f;
-            points.push_back(Vec3(vertX, vertY, vertZ));
-
-
-
-            // Calculate texture coordinates
-            float texX = i / (float)(n_width - 1);
-            float texY = j / (float)(n_height - 1);
-            texCoords.push_back(Vec2(texX, texY));
-        }
-    }
-
-
-
-    // Generate element indices via triangle strips
-    for (int j = 0; j < n_width - 1; ++j) {
-
-
-
-        // Push two vertices at the base of each strip
-        float baseX = j * n_width;
-        indices.push_back(baseX);
-
-
-
-        float baseY = ((j + 1) * n_width);
-        indices.push_back(baseY);
-
-
-
-        for (int i = 1; i < n_height; ++i) {
-
-
-
-            // Calculate next two vertices
-            float tempX = i + j * n_width;
-            indices.push_back(tempX);
-
-
-
-            float tempY = i + (j + 1) * n_height;
-            indices.push_back(tempY);
-        }
-
-
-
-        // A new strip will begin when this index is reached
-        indices.push_back(resPrim);
-    }
-
-
-
-    terrainMesh->set_vbo<Vec3>("vposition", points);
-    terrainMesh->set_triangles(indices);
-    terrainMesh->set_vtexcoord(texCoords);
-    
+    // Flat 1024^2 grid of triangle strips, 5x5 units centred at (0, 0); the
+    // water surfaces draw the same buffers
+    terrainMesh = gridMeshCache().get(gridResolution, gridExtent, resPrim, gridVertexFormat, gridIndexOrder);
 }
 
-
+// The water surfaces: the shared grid, one patch drawn once per tile over
+// low ground, or the projected grid (both surfaces draw the same one)
 void genWaterMesh() {
-
-    // Generate a flat mesh for the terrain with given dimensions, using triangle strips
-    waterMesh = std::unique_ptr<GPUMesh>(new GPUMesh());
-
-
-    // Grid resolution
-    int n_width = 1024;
-    int n_height = 1024;
-    //int n_width = 256;
-    //int n_height = 256;
-
-
-
-    // Grid dimensions (centered at (0, 0))
-    float f_width = 5.0f;
-    float f_height = 5.0f;
-
-
-
-    std::vector<Vec3> points;
-    std::vector<unsigned int> indices;
-    std::vector<Vec2> texCoords;
-
-
-
-    // Generate vertex and texture coordinates
-    for (int j = 0; j < n_width; ++j) {
-        for (int i = 0; i < n_height; ++i) {
-
-
-
-            // Calculate vertex positions
-            float vertX = -f_width / 2 + j / (float)n_width * f_width;
-            float vertY = -f_height / 2 + i / (float)n_height * f_height;
-            float vertZ = 0.57f;
-            points.push_back(Vec3(vertX, vertY, vertZ));
-
-
-
-            // Calculate texture coordinates
-            float texX = i / (float)(n_width - 1);
-            float texY = j / (float)(n_height - 1);
-            texCoords.push_back(Vec2(texX, texY));
-        }
+    if (projectedWater) {
+        waterProjector = std::unique_ptr<ProjectedGrid>(new ProjectedGrid(projectedWaterColumns, projectedWaterRows, resPrim));
+    } else if (fullWater) {
+        waterMesh = gridMeshCache().get(gridResolution, gridExtent, resPrim, gridVertexFormat, gridIndexOrder);
+    } else {
+        waterPatches = std::unique_ptr<WaterPatches>(new WaterPatches(gridResolution, waterTileQuads, resPrim));
     }
-
-
-
-    // Generate element indices via triangle strips
-    for (int j = 0; j < n_width - 1; ++j) {
-
-
-
-        // Push two vertices at the base of each strip
-        float baseX = j * n_width;
-        indices.push_back(baseX);
-
-
-
-        float baseY = ((j + 1) * n_width);
-        indices.push_back(baseY);
-
-
-
-        for (int i = 1; i < n_height; ++i) {
-
-
-
-            // Calculate next two vertices
-            float tempX = i + j * n_width;
-            indices.push_back(tempX);
-
-
-
-            float tempY = i + (j + 1) * n_height;
-            indices.push_back(tempY);
-        }
-
-
-
-        // A new strip will begin when this index is reached
-        indices.push_back(resPrim);
-    }
-
-
-
-    waterMesh->set_vbo<Vec3>("vposition", points);
-    waterMesh->set_triangles(indices);
-    waterMesh->set_vtexcoord(texCoords);
-
 }
 
 void genWater2Mesh() {
+    if (projectedWater) {
+        return;
+    } else if (fullWater) {
+        water2Mesh = gridMeshCache().get(gridResolution, gridExtent, resPrim, gridVertexFormat, gridIndexOrder);
+    } else {
+        water2Patches = std::unique_ptr<WaterPatches>(new WaterPatches(gridResolution, waterTileQuads, resPrim));
+    }
+}
 
-    // Generate a flat mesh for the terrain with given dimensions, using triangle strips
-    water2Mesh = std::unique_ptr<GPUMesh>(new GPUMesh());
-
-
-    // Grid resolution
-    int n_width = 1024;
-    int n_height = 1024;
-    //int n_width = 256;
-    //int n_height = 256;
-
+// A vertex shader drawn on the shared grid: grid_vertex.glsl, for the chosen
+// vertex format, inserted after its #version line
+std::string gridVertexShader(const char *source) {
+    return gridVertexShader(source, gridVertexFormat);
+}
 
+std::string gridVertexShader(const char *source, GridVertexFormat format) {
+    std::string code = source;
+    size_t line = code.find('\n', code.find("#version")) + 1;
+    std::ostringstream grid;
+    grid << "#define GRID_FORMAT " << (int) format << "\n" << grid_vertex;
+    return code.insert(line, grid.str());
+}
 
-    // Grid dimensions (centered at (0, 0))
-    float f_width = 5.0f;
-    float f_height = 5.0f;
+void genTileMesh() {
 
+    // One grid shared by every tile: tileSamples^2 vertices over [0,1]^2 plus
+    // a ring of skirt vertices (z = 1) that the shader pushes down
+    tileMesh = std::unique_ptr<GPUMesh>(new GPUMesh());
 
+    int n = tileSamples + 2;
 
     std::vector<Vec3> points;
     std::vector<unsigned int> indices;
     std::vector<Vec2> texCoords;
+    points.reserve(gridVertexCount(n, n));
+    texCoords.reserve(gridVertexCount(n, n));
 
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
 
+            // Skirt vertices repeat the edge of the tile
+            int x = std::min(std::max(j - 1, 0), tileSamples - 1);
+            int y = std::min(std::max(i - 1, 0), tileSamples - 1);
+            bool skirt = x != j - 1 || y != i - 1;
 
-    // Generate vertex and texture coordinates
-    for (int j = 0; j < n_width; ++j) {
-        for (int i = 0; i < n_height; ++i) {
-
+            points.push_back(Vec3(x / (float)(tileSamples - 1), y / (float)(tileSamples - 1), skirt ? 1.0f : 0.0f));
 
-
-            // Calculate vertex positions
-            float vertX = -f_width / 2 + j / (float)n_width * f_width;
-            float vertY = -f_height / 2 + i / (float)n_height * f_height;
-            float vertZ = 0.57f;
-            points.push_back(Vec3(vertX, vertY, vertZ));
-
-
-
-            // Calculate texture coordinates
-            float texX = i / (float)(n_width - 1);
-            float texY = j / (float)(n_height - 1);
-            texCoords.push_back(Vec2(texX, texY));
+            // Texel centres; columns follow world y like the 5x5 patch
+            texCoords.push_back(Vec2((y + 0.5f) / tileSamples, (x + 0.5f) / tileSamples));
         }
     }
 
+    generatePatchIndices(n, n, resPrim, indices);
 
-
-    // Generate element indices via triangle strips
-    for (int j = 0; j < n_width - 1; ++j) {
-
-
-
-        // Push two vertices at the base of each strip
-        float baseX = j * n_width;
-        indices.push_back(baseX);
-
-
-
-        float baseY = ((j + 1) * n_width);
-        indices.push_back(baseY);
-
-
-
-        for (int i = 1; i < n_height; ++i) {
-
-
-
-            // Calculate next two vertices
-            float tempX = i + j * n_width;
-            indices.push_back(tempX);
-
-
-
-            float tempY = i + (j + 1) * n_height;
-            indices.push_back(tempY);
-        }
-
-
-
-        // A new strip will begin when this index is reached
-        indices.push_back(resPrim);
-    }
-
-
-
-    water2Mesh->set_vbo<Vec3>("vposition", points);
-    water2Mesh->set_triangles(indices);
-    water2Mesh->set_vtexcoord(texCoords);
-
+    tileMesh->set_vbo<Vec3>("vposition", points);
+    tileMesh->set_triangles(indices);
+    tileMesh->set_vtexcoord(texCoords);
 }
 
-
-
-
 void genCubeMesh() {
 
     // Generate a cube mesh for skybox
@@ -666,6 +844,163 @@ void drawSkybox() {
 
     skyboxShader->unbind();
 }
+// Rebuilds the heightmap from per-octave layers after a parameter change; the
+// layers are computed on the first change and extended when octaves are added.
+// Graph presets and the simplex basis have no octave layers, so those regenerate.
+void retuneTerrain() {
+    const int size = 2048;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    float *noise_data;
+    if (activePreset->compose) {
+        noise_data = activePreset->compose(size, size, 512, terrainSeed, tunedParams);
+    } else if (activePreset->basis == NoiseBasis::Simplex) {
+        noise_data = activePreset->hybrid
+            ? HybridMultifractal2D(size, size, 512, terrainSeed, tunedParams, NoiseBasis::Simplex)
+            : fBm2D(size, size, 512, terrainSeed, tunedParams, NoiseBasis::Simplex);
+    } else {
+        if (!octaveLayers) {
+            octaveLayers = std::unique_ptr<OctaveLayers>(new OctaveLayers(size, size, 512, terrainSeed,
+                (int) tunedParams.lacunarity, activePreset->cubicFade ? cubicFade : fade));
+        }
+        noise_data = activePreset->hybrid ? octaveLayers->hybridMultifractal(tunedParams)
+                                          : octaveLayers->fBm(tunedParams);
+    }
+    erodeHeightmap(noise_data, size, size, patchCellSize(size), terrainErosion);
+    terrainHeights = quantizeHeightmap(noise_data, size, size, heightmapFormat);
+    heightTexture = std::unique_ptr<GenericTexture>(uploadHeightmapTexture(terrainHeights));
+    delete[] noise_data;
+    std::vector<float> samples = terrainHeights.decode();
+    terrainPyramid = std::unique_ptr<HeightPyramid>(new HeightPyramid(samples.data(), size, size));
+    updateNormalTexture(samples.data());
+    updateTerrainLod();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "H " << tunedParams.H << " offset " << tunedParams.offset << " octaves " << tunedParams.octaves
+              << ": " << ms << " ms (";
+    if (octaveLayers) {
+        std::cout << octaveLayers->count() << " layers, " << (octaveLayers->bytes() >> 20) << " MB";
+    } else {
+        std::cout << (activePreset->compose ? "graph" : "simplex");
+    }
+    std::cout << "), max height error " << terrainHeights.maxError << std::endl;
+}
+
+// Normals of the fixed map for the current preset and parameters: analytic
+// when the generator allows it, otherwise Sobel over the stored heights
+void updateNormalTexture(const float *samples) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    NormalMap normals = terrainNormalMap(*activePreset, tunedParams, terrainSeed, 512, terrainErosion.enabled(),
+                                         samples, terrainHeights.width, terrainHeights.height);
+    normalTexture = std::unique_ptr<RG16SnormTexture>(uploadNormalTexture(normals));
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Normals (" << (normals.analytic ? "analytic" : "sobel") << "): " << ms << " ms" << std::endl;
+}
+
+// What the clipmap, CDLOD and RTIN modes and the water tiles need built from
+// the heights
+TerrainLodSettings terrainLodSettings() {
+    TerrainLodSettings settings;
+    settings.clipmap = clipmapTerrain;
+    settings.cdlod = cdlodTerrain;
+    settings.cdlodSettings.viewportHeight = height;
+    settings.waterCoverage = !fullWater && !projectedWater;
+    settings.rtin = rtinTerrain;
+    settings.rtinReport = rtinReport;
+    settings.rtinMaxError = rtinMaxError;
+    settings.gridN = gridResolution;
+    settings.gridSize = gridExtent;
+    settings.waterTileQuads = waterTileQuads;
+    settings.restart = resPrim;
+    return settings;
+}
+
+// Rebuilds the levels, the quadtree, the adaptive mesh and the water tiles'
+// coverage from the heights after they change. This runs on the render
+// thread, so its parallel work goes to renderPool: a progressive start keeps
+// noisePool busy with the next level.
+void updateTerrainLod() {
+    if (!terrainPyramid) return;
+    swapInTerrainLod(buildTerrainLod(*terrainPyramid, terrainLodSettings(), renderPool()));
+}
+
+// Makes lod the one drawn: only its GL objects are created here
+void swapInTerrainLod(TerrainLod lod) {
+    terrainClipmap = std::move(lod.clipmap);
+    cdlodRenderer.reset();
+    terrainQuadtree = std::move(lod.quadtree);
+    if (terrainQuadtree) {
+        cdlodRenderer = std::unique_ptr<CDLODRenderer>(new CDLODRenderer(*terrainQuadtree, resPrim));
+    }
+    if (lod.water) {
+        waterTileCoverage = std::move(lod.water);
+    }
+    terrainRTIN = std::move(lod.rtin);
+    if (lod.rtinMesh) {
+        rtinMesh = rtinGPUMesh(*lod.rtinMesh);
+        rtinTriangles = lod.rtinMesh->triangleCount();
+    }
+}
+
+// Progressive startup: swaps in the newest level the background generator has
+// finished. Its heights, normals and TerrainLod were built on the generator's
+// thread; this uploads textures and meshes and swaps pointers.
+void updateProgressiveHeightmap() {
+    if (!progressiveHeightmap) return;
+    std::unique_ptr<HeightmapLevel> level = progressiveHeightmap->take();
+    if (!level) return;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    terrainHeights = std::move(level->heights);
+    heightTexture = std::unique_ptr<GenericTexture>(uploadHeightmapTexture(terrainHeights));
+    normalTexture = std::unique_ptr<RG16SnormTexture>(uploadNormalTexture(level->normals));
+
+    // The old quadtree refers to the old pyramid, so it goes first
+    swapInTerrainLod(std::move(level->lod));
+    terrainPyramid = std::move(level->pyramid);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Heightmap level " << terrainHeights.width << "^2 after " << level->ms << " ms (swapped in "
+              << ms << " ms, normals " << (level->normals.analytic ? "analytic" : "sobel") << ")" << std::endl;
+
+    if (level->final) {
+        std::cout << "Heightmap stored as " << heightmapFormatName(heightmapFormat) << " ("
+                  << (terrainHeights.bytes.size() >> 20) << " MB), max height error " << terrainHeights.maxError << std::endl;
+        progressiveHeightmap.reset();
+        fullQualityPending = true;
+    }
+}
+
+// Time from the start of main to the first frame, and to the first frame
+// drawn from the full-resolution map. glFinish makes each time include that
+// frame's GPU work; it only runs for those two frames.
+void reportStartupTimes() {
+    if (firstFrameDrawn && !fullQualityPending) return;
+    glFinish();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - programStart).count();
+
+    if (!firstFrameDrawn) {
+        firstFrameDrawn = true;
+        std::cout << "Time to first frame: " << ms << " ms";
+        if (!heightTexture) std::cout << " (terrain still generating)";
+        else if (!fullQualityPending) std::cout << " (" << terrainHeights.width << "^2 preview)";
+        std::cout << std::endl;
+    }
+    if (fullQualityPending) {
+        fullQualityPending = false;
+        std::cout << "Time to full quality: " << ms << " ms" << std::endl;
+    }
+}
+
+// Infinite terrain: moves the 5x5 water patch under the camera in whole
+// patch steps, so its texture stays continuous
+Mat4x4 waterFollowCamera() {
+    float x = 5.0f * std::floor(cameraPos[0] / 5.0f + 0.5f);
+    float y = 5.0f * std::floor(cameraPos[1] / 5.0f + 0.5f);
+    return translate(x, y, 0.0f);
+}
+
 float rotation = 0.0f;
 double prevTime = glfwGetTime();
 void drawWater() {
@@ -674,7 +1009,13 @@ void drawWater() {
     // TODO: Generate and set Model, M matrix and set it as a uniform variable for the terainShader. You may consider an identity matrix. 
     //Mat4x4 M = Mat4x4::Identity(); // Identity should be fine
     Mat4x4 M = Mat4x4::Identity();
+    if (infiniteTerrain) {
+        M = waterFollowCamera();
+    }
     waterShader->set_uniform("M", M);
+    waterShader->set_uniform("zOffset", waterZOffset);
+    waterShader->set_uniform("gridN", gridResolution);
+    waterShader->set_uniform("gridSize", gridExtent);
 
     // TODO: Generate and set View, V matrix and set it as a uniform variable of the terrainShader. use lookAt() function.
     Vec3 look = cameraFront + cameraPos;
@@ -702,17 +1043,31 @@ void drawWater() {
     heightTexture->bind();
     waterShader->set_uniform("noiseTex", 0);
 
-    // Draw terrain using triangle strips
-    glEnable(GL_DEPTH_TEST);
-    waterMesh->set_attributes(*waterShader);
-    waterMesh->set_mode(GL_TRIANGLE_STRIP);
-    glEnable(GL_PRIMITIVE_RESTART);
-    glPrimitiveRestartIndex(resPrim);
-
-    waterMesh->draw();
+    // Precomputed normals, on the unit after the six surface textures
+    glActiveTexture(GL_TEXTURE7);
+    normalTexture->bind();
+    waterShader->set_uniform("normalTex", 7);
 
-    // Generate wave motion and set uniform wave_motion
+    // Draw the projected grid out to the far plane, the tiles over low ground
+    // where the wave has moved the sheet (along x, as water_vshader does), or
+    // the whole shared grid; the grid's mode (strips or a list) follows the
+    // index order
+    glEnable(GL_DEPTH_TEST);
     waterShader->set_uniform("waveMotion", waveMotion);
+    if (waterProjector) {
+        waterProjector->draw(*waterShader, P * V * M, waterZOffset, 60.0f);
+    } else if (waterPatches) {
+        waterPatches->select(waterTileCoverage.get(), waterZOffset, std::cos(2.0f * 3.14f / waveMotion), 0.0f);
+        waterPatches->draw(*waterShader);
+    } else {
+        waterMesh->set_attributes(*waterShader);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(resPrim);
+
+        waterMesh->draw();
+    }
+
+    // Generate wave motion for the next frame
     waveMotion += 0.00004f;
     if (waveMotion > 1.0f) {
         waveMotion = 0.4f;
@@ -727,7 +1082,13 @@ void drawWater2() {
     // TODO: Generate and set Model, M matrix and set it as a uniform variable for the terainShader. You may consider an identity matrix. 
     //Mat4x4 M = Mat4x4::Identity(); // Identity should be fine
     Mat4x4 M = Mat4x4::Identity();
+    if (infiniteTerrain) {
+        M = waterFollowCamera();
+    }
     water2Shader->set_uniform("M", M);
+    water2Shader->set_uniform("zOffset", waterZOffset);
+    water2Shader->set_uniform("gridN", gridResolution);
+    water2Shader->set_uniform("gridSize", gridExtent);
 
     // TODO: Generate and set View, V matrix and set it as a uniform variable of the terrainShader. use lookAt() function.
     Vec3 look = cameraFront + cameraPos;
@@ -755,17 +1116,28 @@ void drawWater2() {
     heightTexture->bind();
     water2Shader->set_uniform("noiseTex", 0);
 
-    // Draw terrain using triangle strips
-    glEnable(GL_DEPTH_TEST);
-    water2Mesh->set_attributes(*water2Shader);
-    water2Mesh->set_mode(GL_TRIANGLE_STRIP);
-    glEnable(GL_PRIMITIVE_RESTART);
-    glPrimitiveRestartIndex(resPrim);
-
-    water2Mesh->draw();
+    // Precomputed normals, on the unit after the six surface textures
+    glActiveTexture(GL_TEXTURE7);
+    normalTexture->bind();
+    water2Shader->set_uniform("normalTex", 7);
 
-    // Generate wave motion and set uniform wave_motion
+    // As drawWater, the wave moving this sheet along y (water2_vshader)
+    glEnable(GL_DEPTH_TEST);
     water2Shader->set_uniform("waveMotion2", waveMotion2);
+    if (waterProjector) {
+        waterProjector->draw(*water2Shader, P * V * M, waterZOffset, 60.0f);
+    } else if (water2Patches) {
+        water2Patches->select(waterTileCoverage.get(), waterZOffset, 0.0f, std::cos(2.0f * 3.14f / waveMotion2));
+        water2Patches->draw(*water2Shader);
+    } else {
+        water2Mesh->set_attributes(*water2Shader);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(resPrim);
+
+        water2Mesh->draw();
+    }
+
+    // Generate wave motion for the next frame
     waveMotion2 += 0.00004f;
     if (waveMotion2 > 1.0f) {
         waveMotion2 = 0.4f;
@@ -775,55 +1147,137 @@ void drawWater2() {
 }
 
 void drawTerrain() {
-    terrainShader->bind();
+
+    // The clipmap, CDLOD and RTIN share the terrain's fragment shader and its inputs
+    Shader &shader = clipmapTerrain ? *clipmapShader : cdlodTerrain ? *cdlodShader
+                   : rtinTerrain ? *rtinShader : *terrainShader;
+    shader.bind();
 
     // TODO: Generate and set Model, M matrix and set it as a uniform variable for the terainShader. You may consider an identity matrix. 
     Mat4x4 M = Mat4x4::Identity(); // Identity should be fine
-    terrainShader->set_uniform("M", M);
+    shader.set_uniform("M", M);
+    shader.set_uniform("zOffset", terrainZOffset);
+    shader.set_uniform("gridN", rtinTerrain ? terrainRTIN->width : gridResolution);
+    shader.set_uniform("gridSize", gridExtent);
 
     // TODO: Generate and set View, V matrix and set it as a uniform variable of the terrainShader. use lookAt() function.
     Vec3 look = cameraFront + cameraPos;
     Mat4x4 V = lookAt(cameraPos, look, Vec3(0, 0, 1));
-    terrainShader->set_uniform("V", V);
+    shader.set_uniform("V", V);
 
     // TODO: Generate and set Projection, P matrix and set it as a uniform variable of the terrainShader. use OpenGP::perspective()/glm::persepctive
     Mat4x4 P = perspective(80.0f, width / (float)height, 0.1f, 60.0f);
-    terrainShader->set_uniform("P", P);
+    shader.set_uniform("P", P);
 
     // Set camera position
-    terrainShader->set_uniform("viewPos", cameraPos);
+    shader.set_uniform("viewPos", cameraPos);
 
     // Bind textures
     int i = 0;
     for (std::map<std::string, std::unique_ptr<RGBA8Texture>>::iterator it = terrainTextures.begin(); it != terrainTextures.end(); ++it) {
         glActiveTexture(GL_TEXTURE1 + i);
         (it->second)->bind();
-        terrainShader->set_uniform(it->first.c_str(), 1 + i);
+        shader.set_uniform(it->first.c_str(), 1 + i);
         ++i;
     }
 
     // TODO: Bind height texture to GL_TEXTURE0 and set uniform noiseTex.
     glActiveTexture(GL_TEXTURE0);
     heightTexture->bind();
-    terrainShader->set_uniform("noiseTex", 0);
+    shader.set_uniform("noiseTex", 0);
+    shader.set_uniform("heightScale", terrainHeights.shaderScale());
+    shader.set_uniform("heightOffset", terrainHeights.shaderOffset());
 
-    // Draw terrain using triangle strips
-    glEnable(GL_DEPTH_TEST);
-    terrainMesh->set_attributes(*terrainShader);
-    terrainMesh->set_mode(GL_TRIANGLE_STRIP);
-    glEnable(GL_PRIMITIVE_RESTART);
-    glPrimitiveRestartIndex(resPrim);
+    // Precomputed normals, on the unit after the six surface textures
+    glActiveTexture(GL_TEXTURE7);
+    normalTexture->bind();
+    shader.set_uniform("normalTex", 7);
 
-    terrainMesh->draw();
+    // Draw terrain
+    glEnable(GL_DEPTH_TEST);
+    if (clipmapTerrain) {
+        terrainClipmap->update(cameraPos[0], cameraPos[1]);
+        terrainClipmap->draw(shader, 8);
+    } else if (cdlodTerrain) {
+        terrainQuadtree->select(cameraPos, viewFrustum(P * V * M), cdlodSelection);
+        cdlodRenderer->draw(shader, cdlodSelection);
+    } else if (rtinTerrain) {
+        rtinMesh->set_attributes(shader);
+        rtinMesh->draw();
+    } else {
+        terrainMesh->set_attributes(shader);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(resPrim);
+
+        terrainMesh->draw();
+    }
 
     // Generate wave motion and set uniform wave_motion
-    terrainShader->set_uniform("waveMotion", waveMotion);
+    shader.set_uniform("waveMotion", waveMotion);
     waveMotion += 0.00004f;
     if (waveMotion > 0.5f) {
         waveMotion =0.4f;
     }
 
-    terrainShader->unbind();
+    shader.unbind();
 }
 
+void drawTiles() {
+    tileStreamer->update(cameraPos, cameraFront);
+
+    tileShader->bind();
+
+    Mat4x4 M = Mat4x4::Identity();
+    tileShader->set_uniform("M", M);
+
+    Vec3 look = cameraFront + cameraPos;
+    Mat4x4 V = lookAt(cameraPos, look, Vec3(0, 0, 1));
+    tileShader->set_uniform("V", V);
+
+    Mat4x4 P = perspective(80.0f, width / (float)height, 0.1f, 60.0f);
+    tileShader->set_uniform("P", P);
+
+    tileShader->set_uniform("viewPos", cameraPos);
+
+    // Bind textures
+    int i = 0;
+    for (std::map<std::string, std::unique_ptr<RGBA8Texture>>::iterator it = terrainTextures.begin(); it != terrainTextures.end(); ++it) {
+        glActiveTexture(GL_TEXTURE1 + i);
+        (it->second)->bind();
+        tileShader->set_uniform(it->first.c_str(), 1 + i);
+        ++i;
+    }
+    tileShader->set_uniform("noiseTex", 0);
+    // Tiles are kept as float
+    tileShader->set_uniform("heightScale", 1.0f);
+    tileShader->set_uniform("heightOffset", 0.0f);
+
+    glEnable(GL_DEPTH_TEST);
+    tileMesh->set_attributes(*tileShader);
+    tileMesh->set_mode(GL_TRIANGLE_STRIP);
+    glEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(resPrim);
+
+    tileShader->set_uniform("normalTex", 7);
+
+    // Each tile binds its own heightmap and normals
+    const std::vector<TileKey> &tiles = tileStreamer->tiles();
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        const TileTextures *textures = tileStreamer->textures(tiles[t]);
+        if (!textures) continue;
+
+        float size = (float) tileSize(tiles[t].lod);
+        glActiveTexture(GL_TEXTURE0);
+        textures->heights->bind();
+        glActiveTexture(GL_TEXTURE7);
+        textures->normals->bind();
+        tileShader->set_uniform("tile", Vec3(tiles[t].x * size, tiles[t].y * size, size));
+        tileShader->set_uniform("skirtDepth", 0.05f * (1 << tiles[t].lod));
+        tileMesh->draw();
+    }
+
+    tileShader->set_uniform("waveMotion", waveMotion);
+
+    tileShader->unbind();
+}
 
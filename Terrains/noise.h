@@ -1,7 +1,11 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include "OpenGP/GL/Application.h"
+#include "parallel.h"
+#include "perlinSIMD.h"
 
 using namespace OpenGP;
 
@@ -15,252 +19,663 @@ inline float lerp(float x, float y, float t) {
 inline float fade(float t) {
     // Quintic interpolation curve
     return t * t * t * (t * (t * 6 - 15) + 10);
+}
 
+inline float cubicFade(float t) {
     // Cubic interpolation curve
-    //return t * t * (3.0f - 2.0f * t);
+    return t * t * (3.0f - 2.0f * t);
 }
 
-inline float rand01() {
-    return ((float) std::rand())/((float) RAND_MAX);
+// Derivatives of the two curves, for analytic noise gradients
+inline float fadeSlope(float t) {
+    return 30.0f * t * t * (t * (t - 2.0f) + 1.0f);
 }
 
-float* perlin2D(const int width, const int height, const int period=64);
+inline float cubicFadeSlope(float t) {
+    return 6.0f * t * (1.0f - t);
+}
 
-// Generates a heightmap using regular fBm (fractional brownian motion)
-R32FTexture* fBm2DTexture() {
+// Seed used when a generator is not given one explicitly
+const uint64_t defaultNoiseSeed = 0x9E3779B97F4A7C15ull;
 
-    // Precompute perlin noise on a 2D grid
-   
-    const int width = 2048;
-    const int height = 2048;
-    float *perlin_data = perlin2D(width, height, 512);
+// SplitMix64 finaliser: every input bit affects every output bit
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
 
-    
-    // fBm parameters - Summer
-    float H = 0.9f;
-    float lacunarity = 2.0f;
-    float offset = 0.1f;
-    const int octaves = 5;
-    
+// Random unit gradient at lattice point (i, j), a pure function of the seed.
+// Lattice points are hashed on demand, so no full-resolution gradient table
+// is needed and any region of the noise can be computed on its own.
+inline Vec2 latticeGradient(uint64_t seed, int i, int j) {
+    uint64_t key = ((uint64_t)(uint32_t) i << 32) | (uint32_t) j;
+    uint64_t hash = mix64(seed ^ mix64(key));
+
+    // Top 24 bits give a uniform angle in [0, 1)
+    float angle = (float)(hash >> 40) * (1.0f / 16777216.0f);
+    return Vec2(cos(2 * angle * M_PI), sin(2 * angle * M_PI));
+}
+
+float* perlin2D(const int width, const int height, const int period=64, const uint64_t seed=defaultNoiseSeed);
+float* simplex2D(const int width, const int height, const int period=64, const uint64_t seed=defaultNoiseSeed);
+void perlin2DRegion(const int width, const int height, const int period, const uint64_t seed,
+                    const int x0, const int y0, const int w, const int h, float *out, const int outStride);
+
+// Corner gradients of every lattice cell of a width x height perlin2D field.
+// Only cells are stored (16 of them for 2048^2 at period 512), so single
+// samples can be taken anywhere without the full-resolution perlin buffer.
+class PerlinLattice {
+public:
+
+    // Everything a sample needs that only depends on the pixel row
+    struct Row {
+        const float *cells;
+        float dy;
+        float fy;
+    };
 
+    // slope is the derivative of curve; only sampleGradient uses it
+    PerlinLattice(const int width, const int height, const int period, const uint64_t seed,
+                  float (*curve)(float) = fade, float (*slope)(float) = fadeSlope)
+        : width(width), height(height), period(period), frequency(1.0f / period), curve(curve), slope(slope) {
 
-    // Initialize to 0s
-    float *noise_data = new float[width * height];
-    for (int i = 0; i < width; ++ i) {
-        for (int j = 0; j < height; ++ j) {
-            noise_data[i + j * height] = 0;
+        cellsX = (width + period - 1) / period;
+        cellsY = (height + period - 1) / period;
+        corners.resize(8 * cellsX * cellsY);
+
+        // dx and fade(dx) only depend on the column
+        dx.resize(width);
+        fx.resize(width);
+        for (int i = 0; i < width; ++i) {
+            int left = (i / period) * period;
+            dx[i] = (i - left) * frequency;
+            fx[i] = curve(dx[i]);
+        }
+
+        for (int cy = 0; cy < cellsY; ++cy) {
+            for (int cx = 0; cx < cellsX; ++cx) {
+                int left = cx * period;
+                int right = (left + period) % width;
+                int top = cy * period;
+                int bottom = (top + period) % height;
+
+                Vec2 g[4] = { latticeGradient(seed, left, top), latticeGradient(seed, right, top),
+                              latticeGradient(seed, left, bottom), latticeGradient(seed, right, bottom) };
+                float *c = &corners[8 * (cx + cy * cellsX)];
+                for (int k = 0; k < 4; ++k) {
+                    c[2 * k] = g[k][0];
+                    c[2 * k + 1] = g[k][1];
+                }
+            }
         }
     }
 
-    // Precompute exponent array
-    float *exponent_array = new float[octaves];
-    float f = 1.0f;
-    for (int i = 0; i < octaves; ++i) {
-        exponent_array[i] = std::pow(f, -H);
-        f *= lacunarity;
+    Row row(const int j) const {
+        int cy = j / period;
+        Row r;
+        r.cells = &corners[8 * cy * cellsX];
+        r.dy = (j - cy * period) * frequency;
+        r.fy = curve(r.dy);
+        return r;
+    }
+
+    // Same value as perlin2D(width, height, period, seed)[i + j * width]
+    float sample(const Row &r, const int i) const {
+        const float *g = &r.cells[8 * (i / period)];
+        float x = dx[i];
+
+        float s = g[0] * x + g[1] * (-r.dy);
+        float t = g[2] * (x - 1) + g[3] * (-r.dy);
+        float u = g[4] * x + g[5] * (1 - r.dy);
+        float v = g[6] * (x - 1) + g[7] * (1 - r.dy);
+
+        float st = lerp(s, t, fx[i]);
+        float uv = lerp(u, v, fx[i]);
+        return lerp(st, uv, r.fy);
+    }
+
+    float sample(const int i, const int j) const {
+        return sample(row(j), i);
+    }
+
+    // d sample / d column and d sample / d row at (i, row), per pixel
+    void sampleGradient(const Row &r, const int i, float &gradX, float &gradY) const {
+        const float *g = &r.cells[8 * (i / period)];
+        float x = dx[i];
+        float blend = fx[i];
+        float sx = slope(x), sy = slope(r.dy);
+
+        float s = g[0] * x + g[1] * (-r.dy);
+        float t = g[2] * (x - 1) + g[3] * (-r.dy);
+        float u = g[4] * x + g[5] * (1 - r.dy);
+        float v = g[6] * (x - 1) + g[7] * (1 - r.dy);
+        float st = lerp(s, t, blend);
+        float uv = lerp(u, v, blend);
+
+        // Along the row: the corner terms grow by g.x, the blend by slope(x)
+        float stX = lerp(g[0], g[2], blend) + sx * (t - s);
+        float uvX = lerp(g[4], g[6], blend) + sx * (v - u);
+        gradX = lerp(stX, uvX, r.fy) * frequency;
+
+        // Across rows the offsets enter negated (-dy, 1 - dy)
+        float stY = -lerp(g[1], g[3], blend);
+        float uvY = -lerp(g[5], g[7], blend);
+        gradY = (lerp(stY, uvY, r.fy) + sy * (uv - st)) * frequency;
+    }
+
+    // Columns [x0, x0 + w) of row j, one SIMD run per lattice cell
+    void fillRow(const int j, const int x0, const int w, float *out) const {
+        Row r = row(j);
+        int i = x0;
+        while (i < x0 + w) {
+            int cx = i / period;
+            int runEnd = std::min((cx + 1) * period, x0 + w);
+            perlinRun(&r.cells[8 * cx], &dx[i], &fx[i], r.dy, r.fy, &out[i - x0], runEnd - i);
+            i = runEnd;
+        }
     }
 
-    for (int i = 0; i < width; ++ i) {
-        for (int j = 0; j < height; ++ j) {
+    int width, height, period;
+
+private:
+    float frequency;
+    float (*curve)(float);
+    float (*slope)(float);
+    int cellsX, cellsY;
+    std::vector<float> corners;
+    std::vector<float> dx, fx;
+};
+
+// One of 32 unit directions, picked by the top bits of a lattice hash: a
+// table lookup instead of latticeGradient's trig
+inline const float *unitDirection(uint64_t hash) {
+    struct Directions {
+        float xy[64];
+        Directions() {
+            for (int k = 0; k < 32; ++k) {
+                xy[2 * k] = (float) std::cos(2 * M_PI * (k + 0.5) / 32);
+                xy[2 * k + 1] = (float) std::sin(2 * M_PI * (k + 0.5) / 32);
+            }
+        }
+    };
+    static const Directions directions;
+    return &directions.xy[2 * (hash >> 59)];
+}
 
-            // TODO: Index (for use in inner loop - frequency)) -I & J
-            int I = i;
-            int J = j;
+// Scales that give simplex samples the spread of perlin2D samples, so either
+// basis can feed the same heights (z = (h + 1) * 0.6)
+const float simplexScale2 = 39.71f;
+const float simplexScale3 = 16.22f;
+
+// Seeded simplex noise in 2D and 3D: three corners per sample in 2D (four in
+// 3D) with a radial falloff, instead of perlin's four (eight) corners and
+// fade/lerp. Corner gradients are hashed from the lattice coordinates like
+// latticeGradient, but picked from a fixed table, so nothing is stored and
+// no trig runs per corner. The field does not repeat: fractal drivers sample
+// each octave at its own frequency instead of wrapping the base field.
+class SimplexField {
+public:
+
+    explicit SimplexField(const uint64_t seed) : seed(seed) {}
+
+    float sample(double x, double y) const {
+        Cell cell;
+        return sample(x, y, cell);
+    }
 
-            for(int k = 0; k < octaves; ++k) {
+    float sample(double x, double y, double z) const {
+        // Skew to the tetrahedral lattice
+        const double F3 = 1.0 / 3.0, G3 = 1.0 / 6.0;
+        double s = (x + y + z) * F3;
+        double fi = std::floor(x + s), fj = std::floor(y + s), fk = std::floor(z + s);
+        double t = (fi + fj + fk) * G3;
+        float x0 = (float)(x - (fi - t)), y0 = (float)(y - (fj - t)), z0 = (float)(z - (fk - t));
+        int i = latticeIndex(fi), j = latticeIndex(fj), k = latticeIndex(fk);
+
+        // Which of the six tetrahedra of the cube the point is in
+        int i1, j1, k1, i2, j2, k2;
+        if (x0 >= y0) {
+            if (y0 >= z0)      { i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+            else if (x0 >= z0) { i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1; }
+            else               { i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1; }
+        } else {
+            if (y0 < z0)       { i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1; }
+            else if (x0 < z0)  { i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1; }
+            else               { i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+        }
 
-                // TODO: Generate perlin value
-                float perlin = perlin_data[(I % width) + (J % height) * height];
+        const float g3 = (float) G3;
+        float n = corner3(i, j, k, x0, y0, z0);
+        n += corner3(i + i1, j + j1, k + k1, x0 - i1 + g3, y0 - j1 + g3, z0 - k1 + g3);
+        n += corner3(i + i2, j + j2, k + k2, x0 - i2 + 2 * g3, y0 - j2 + 2 * g3, z0 - k2 + 2 * g3);
+        n += corner3(i + 1, j + 1, k + 1, x0 - 1 + 3 * g3, y0 - 1 + 3 * g3, z0 - 1 + 3 * g3);
+        return simplexScale3 * n;
+    }
 
+    // out[n] = sample(x0 + n * step, y) for n < count. Corner gradients are
+    // kept while consecutive samples stay in the same lattice cell.
+    void fillRow(const double x0, const double step, const double y, const int count, float *out) const {
+        Cell cell;
+        for (int n = 0; n < count; ++n) {
+            out[n] = sample(x0 + n * step, y, cell);
+        }
+    }
 
+private:
 
-                // TODO: Generate noise value
-                noise_data[i + j * height] += (perlin + offset) * exponent_array[k];
+    // Gradients of the four corners of the skewed square last sampled
+    struct Cell {
+        int i = 0x7FFFFFFF, j = 0;
+        float g[8];
+    };
 
+    // A lattice coordinate as the low 32 bits the hashes read, exact for any
+    // double, so deep octaves far from the origin stay defined
+    static int latticeIndex(const double f) {
+        const double wrap = 4294967296.0;
+        return (int)(uint32_t)(f - wrap * std::floor(f / wrap));
+    }
 
+    uint64_t hash(int i, int j) const {
+        uint64_t key = ((uint64_t)(uint32_t) i << 32) | (uint32_t) j;
+        return mix64(seed ^ mix64(key));
+    }
 
-                // TODO: Point to sample at next octave
-                I *= (int)lacunarity;
-                J *= (int)lacunarity;
-                
+    float sample(double x, double y, Cell &cell) const {
+        // Skew to the triangular lattice
+        const double F2 = 0.36602540378443864676, G2 = 0.21132486540518711775;
+        double s = (x + y) * F2;
+        double fi = std::floor(x + s), fj = std::floor(y + s);
+        double t = (fi + fj) * G2;
+        float x0 = (float)(x - (fi - t)), y0 = (float)(y - (fj - t));
+        int i = latticeIndex(fi), j = latticeIndex(fj);
+
+        if (i != cell.i || j != cell.j) {
+            cell.i = i;
+            cell.j = j;
+            for (int c = 0; c < 4; ++c) {
+                const float *g = unitDirection(hash(i + (c & 1), j + (c >> 1)));
+                cell.g[2 * c] = g[0];
+                cell.g[2 * c + 1] = g[1];
             }
         }
+
+        // Lower or upper triangle of the cell
+        const float g2 = (float) G2;
+        int c1 = x0 > y0 ? 1 : 2;
+        float x1 = x0 - (c1 & 1) + g2, y1 = y0 - (c1 >> 1) + g2;
+        float x2 = x0 - 1 + 2 * g2, y2 = y0 - 1 + 2 * g2;
+
+        float n = corner2(&cell.g[0], x0, y0) + corner2(&cell.g[2 * c1], x1, y1) + corner2(&cell.g[6], x2, y2);
+        return simplexScale2 * n;
     }
 
-    R32FTexture* _tex = new R32FTexture();
-    _tex->upload_raw(width, height, noise_data);
+    static float corner2(const float *g, float x, float y) {
+        float falloff = std::max(0.0f, 0.5f - x * x - y * y);
+        falloff *= falloff;
+        return falloff * falloff * (g[0] * x + g[1] * y);
+    }
 
-    // Clean up
-    delete perlin_data;
-    delete noise_data;
-    delete exponent_array;
+    float corner3(int i, int j, int k, float x, float y, float z) const {
+        // The 12 cube edge directions, 4 of them twice
+        static const float edges[16][3] = {
+            { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+            { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+            { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 },
+            { 1, 1, 0 }, { -1, 1, 0 }, { 0, -1, 1 }, { 0, -1, -1 } };
+        float falloff = std::max(0.0f, 0.6f - x * x - y * y - z * z);
+        if (falloff == 0.0f) return 0.0f;
+        uint64_t key = mix64(seed ^ (uint32_t) i) ^ ((uint64_t)(uint32_t) j << 32 | (uint32_t) k);
+        const float *g = edges[mix64(key) >> 60];
+        falloff *= falloff;
+        return falloff * falloff * (g[0] * x + g[1] * y + g[2] * z);
+    }
 
-    return _tex;
+    uint64_t seed;
+};
+
+// Parameters shared by the fractal drivers
+struct FractalParams {
+    float H;
+    float lacunarity;
+    float offset;
+    int octaves;
+};
+
+// Gradient noise the fractal drivers sum
+enum class NoiseBasis { Perlin, Simplex };
+
+inline const char *noiseBasisName(NoiseBasis basis) {
+    return basis == NoiseBasis::Simplex ? "simplex" : "perlin";
 }
 
-// Generates a height map using Hybrid Multifractal fBM (fractional Brownian motion)[optional]
-R32FTexture* HybridMultifractal2DTexture() {
+inline bool parseNoiseBasis(const std::string &name, NoiseBasis &basis) {
+    if (name == "perlin") basis = NoiseBasis::Perlin;
+    else if (name == "simplex") basis = NoiseBasis::Simplex;
+    else return false;
+    return true;
+}
 
-    // Precompute perlin noise on a 2D grid
-    const int width = 2048;
-    const int height = 2048;
-    float *perlin_data = perlin2D(width, height, 512);
-    
-    // fBm parameters - Lunar
-    /*
-    float H = 0.8f;
-    float lacunarity = 4.0f;
-    float offset = 0.7f;
-    const int octaves = 43;
-    */
-    float H = 0.9f;
-    float lacunarity = 2.0f;
-    float offset = 0.1f;
-    const int octaves = 5;
-    /*
-    float H = 0.25f;
-    float lacunarity = 2.0f;
-    float offset = 0.7f;
-    const int octaves = 16;
-    */
-
-    // Initialize to 0s
-    float *noise_data = new float[width * height];
-    for (int i = 0; i < width; ++ i) {
-        for (int j = 0; j < height; ++ j) {
-            noise_data[i + j * height] = 0.0f;
+// Octave k of a fractal over one source is shifted by k * octaveShift (in the
+// source's own units), so that the octaves do not line up at the origin
+const double octaveShift = 0.49497;
+
+// The octaves of a simplex fractal. Octave k is its own field (seeded from
+// seed and k) sampled at (i, j) * lacunarity^k / period + k * octaveShift.
+// The field does not repeat, so the step is the true frequency: deep octaves
+// are noise finer than a pixel, never a wrapped lower frequency.
+struct SimplexOctaves {
+
+    SimplexOctaves(const int width, const int height, const int period, const uint64_t seed, const FractalParams &params)
+        : width(width), height(height) {
+        double frequency = 1.0 / period;
+        for (int k = 0; k < params.octaves; ++k) {
+            fields.push_back(SimplexField(mix64(seed + k)));
+            steps.push_back(frequency);
+            frequency *= params.lacunarity;
         }
     }
 
-    // Precompute exponent array
-    float *exponent_array = new float[octaves];
+    void fillRow(const int k, const int j, float *out) const {
+        const double shift = k * octaveShift;
+        fields[k].fillRow(shift, steps[k], j * steps[k] + shift, width, out);
+    }
+
+    int width, height;
+    std::vector<SimplexField> fields;
+    std::vector<double> steps;
+};
+
+// Amplitude of each octave, lacunarity^(-H k)
+inline std::vector<float> fractalExponents(const FractalParams &params) {
+    std::vector<float> exponent_array(params.octaves);
     float f = 1.0f;
-    for (int i = 0; i < octaves; ++i) {
-        exponent_array[i] = pow( f, -H);
-        f *= lacunarity;
+    for (int i = 0; i < params.octaves; ++i) {
+        exponent_array[i] = std::pow(f, -params.H);
+        f *= params.lacunarity;
+    }
+    return exponent_array;
+}
+
+// Per-worker scratch for the row evaluators
+struct FractalScratch {
+    std::vector<float> rows;     // one base-field row per octave
+    std::vector<int> columns;    // column each octave samples for the current pixel
+    std::vector<int> steps;      // lacunarity^k mod width
+};
+
+// One row of fBm heights. Octave k samples the base field at
+// (i, j) * lacunarity^k, wrapped to the field: its row is produced once by the
+// SIMD kernel, then every octave of a pixel is summed in registers and the
+// height is written once. Scratch is octaves * width floats.
+inline void fBmRow(const PerlinLattice &lattice, const FractalParams &params, const float *exponents,
+                   const int j, float *out, FractalScratch &scratch) {
+
+    const int width = lattice.width;
+    const int octaves = params.octaves;
+    const int lacunarity = (int) params.lacunarity;
+    scratch.rows.resize(octaves * width);
+    scratch.columns.assign(octaves, 0);
+    scratch.steps.resize(octaves);
+
+    // Base-field row and column step of each octave
+    int J = j % lattice.height;
+    int step = 1;
+    for (int k = 0; k < octaves; ++k) {
+        lattice.fillRow(J, 0, width, &scratch.rows[k * width]);
+        scratch.steps[k] = step;
+        J = (J * lacunarity) % lattice.height;
+        step = (step * lacunarity) % width;
     }
 
+    const float *rows = scratch.rows.data();
+    int *columns = scratch.columns.data();
+    const int *steps = scratch.steps.data();
+
     for (int i = 0; i < width; ++i) {
-        for (int j = 0; j < height; ++j) {
+        float noise = 0.0f;
+        for (int k = 0; k < octaves; ++k) {
+            float perlin = rows[k * width + columns[k]];
+            noise += (perlin + params.offset) * exponents[k];
+
+            // Point to sample at next pixel
+            columns[k] += steps[k];
+            if (columns[k] >= width) columns[k] -= width;
+        }
+        out[i] = noise;
+    }
+}
 
-            // TODO: Index (for use in inner loop - frequency)
-            int I = i;
-            int J = j;
+// fBmRow on the simplex basis: one row per octave, summed into out
+inline void fBmRow(const SimplexOctaves &octaves, const FractalParams &params, const float *exponents,
+                   const int j, float *out, FractalScratch &scratch) {
 
-            // TODO: Generate Perlin value (Hybrid Multifractal (1 - abs(perlin)))
-            float perlin = 1- abs(perlin_data[(I % width) + (J % height) * height]);
+    const int width = octaves.width;
+    scratch.rows.resize(width);
+    float *row = scratch.rows.data();
 
-            //float result = (perlin + offset) * exponent_array[0];
-            float weight = perlin;
+    for (int i = 0; i < width; ++i) out[i] = 0.0f;
+    for (int k = 0; k < params.octaves; ++k) {
+        octaves.fillRow(k, j, row);
+        for (int i = 0; i < width; ++i) {
+            out[i] += (row[i] + params.offset) * exponents[k];
+        }
+    }
+}
 
-            //TODO:  Point to sample at next octave
-            I *= (int)lacunarity;
-            J *= (int)lacunarity;
+// Hybrid Multifractal heights of one row from the first octave's samples;
+// the weight recursion reads nothing else
+inline void hybridMultifractalFromBase(const float *base, const FractalParams &params, const float *exponents,
+                                       const int width, float *out) {
 
-            for (int k = 1; k < octaves; k++) {
+    for (int i = 0; i < width; ++i) {
 
-                // TODO: Restrict weight to be less than one (guard against divergence)
-                if (weight > 1.0) {
-                    weight = 1.0;
-                }
+        // Generate Perlin value (Hybrid Multifractal (1 - abs(perlin)))
+        float perlin = 1 - abs(base[i]);
+        float weight = perlin;
 
-                // TODO:Generate Perlin value
-                float signal = (perlin + offset) * exponent_array[k];
+        for (int k = 1; k < params.octaves; k++) {
 
-                // TODO: Add weighted Perlin value to Perlin
-                perlin += weight * signal;
-                // TODO: Adjust weighting value
-                weight *= signal;
-                // TODO: Point to sample at next octave
-                I *= (int)lacunarity;
-                J *= (int)lacunarity;
+            // Restrict weight to be less than one (guard against divergence)
+            if (weight > 1.0) {
+                weight = 1.0;
             }
 
-            // Generate noise value
-            int noiseIndex = i + j * height;
-            noise_data[noiseIndex] = perlin;
+            float signal = (perlin + params.offset) * exponents[k];
+
+            // Add weighted value and adjust weighting value
+            perlin += weight * signal;
+            weight *= signal;
+        }
+
+        out[i] = perlin;
+    }
+}
+
+// One row of Hybrid Multifractal heights, fused the same way as fBmRow
+inline void hybridMultifractalRow(const PerlinLattice &lattice, const FractalParams &params, const float *exponents,
+                                  const int j, float *out, FractalScratch &scratch) {
+    scratch.rows.resize(lattice.width);
+    lattice.fillRow(j % lattice.height, 0, lattice.width, scratch.rows.data());
+    hybridMultifractalFromBase(scratch.rows.data(), params, exponents, lattice.width, out);
+}
+
+inline void hybridMultifractalRow(const SimplexOctaves &octaves, const FractalParams &params, const float *exponents,
+                                  const int j, float *out, FractalScratch &scratch) {
+    scratch.rows.resize(octaves.width);
+    octaves.fillRow(0, j, scratch.rows.data());
+    hybridMultifractalFromBase(scratch.rows.data(), params, exponents, octaves.width, out);
+}
+
+// Runs rowFn(j, row, scratch) for every row of a width x height map, writing
+// straight into the returned buffer; nothing else of full-grid size is allocated
+template <typename RowFn>
+float* fractal2D(const int width, const int height, RowFn rowFn) {
+    float *noise_data = new float[width * height];
+    noisePool().parallelFor(height, [&](int rowBegin, int rowEnd) {
+        FractalScratch scratch;
+        for (int j = rowBegin; j < rowEnd; ++j) {
+            rowFn(j, &noise_data[(size_t) j * width], scratch);
         }
+    });
+    return noise_data;
+}
+
+// The fractal drivers over either basis. Perlin octaves are the base field
+// wrapped around the map, so those heights tile; simplex heights do not.
+template <typename RowFn>
+float* fractal2D(const int width, const int height, const int period, const uint64_t seed,
+                 const FractalParams &params, NoiseBasis basis, RowFn rowFn) {
+    std::vector<float> exponents = fractalExponents(params);
+    if (basis == NoiseBasis::Simplex) {
+        SimplexOctaves octaves(width, height, period, seed, params);
+        return fractal2D(width, height, [&](int j, float *row, FractalScratch &scratch) {
+            rowFn(octaves, exponents.data(), j, row, scratch);
+        });
+    }
+    PerlinLattice lattice(width, height, period, seed);
+    return fractal2D(width, height, [&](int j, float *row, FractalScratch &scratch) {
+        rowFn(lattice, exponents.data(), j, row, scratch);
+    });
+}
+
+// Calls fBmRow / hybridMultifractalRow on whichever basis fractal2D picked
+struct FBmRows {
+    const FractalParams &params;
+    template <typename Basis>
+    void operator()(const Basis &basis, const float *exponents, int j, float *row, FractalScratch &scratch) const {
+        fBmRow(basis, params, exponents, j, row, scratch);
+    }
+};
+
+struct HybridMultifractalRows {
+    const FractalParams &params;
+    template <typename Basis>
+    void operator()(const Basis &basis, const float *exponents, int j, float *row, FractalScratch &scratch) const {
+        hybridMultifractalRow(basis, params, exponents, j, row, scratch);
     }
+};
+
+float* fBm2D(const int width, const int height, const int period, const uint64_t seed, const FractalParams &params,
+             NoiseBasis basis=NoiseBasis::Perlin) {
+    return fractal2D(width, height, period, seed, params, basis, FBmRows{ params });
+}
+
+float* HybridMultifractal2D(const int width, const int height, const int period, const uint64_t seed,
+                            const FractalParams &params, NoiseBasis basis=NoiseBasis::Perlin) {
+    return fractal2D(width, height, period, seed, params, basis, HybridMultifractalRows{ params });
+}
+
+// Generates a heightmap using regular fBm (fractional brownian motion)
+R32FTexture* fBm2DTexture(const uint64_t seed=defaultNoiseSeed) {
+
+    const int width = 2048;
+    const int height = 2048;
+
+    // fBm parameters - Summer
+    FractalParams params;
+    params.H = 0.9f;
+    params.lacunarity = 2.0f;
+    params.offset = 0.1f;
+    params.octaves = 5;
+
+    float *noise_data = fBm2D(width, height, 512, seed, params);
 
     R32FTexture* _tex = new R32FTexture();
     _tex->upload_raw(width, height, noise_data);
 
     // Clean up
-    delete perlin_data;
-    delete noise_data;
-    delete exponent_array;
+    delete[] noise_data;
 
     return _tex;
 }
 
-float* perlin2D(const int width, const int height, const int period) {
+// Generates a height map using Hybrid Multifractal fBM (fractional Brownian motion)[optional]
+R32FTexture* HybridMultifractal2DTexture(const uint64_t seed=defaultNoiseSeed) {
 
-    // Precompute random gradients
-    float *gradients = new float[width * height * 2];
-    auto sample_gradient = [&](int i, int j) {
-        float x = gradients[2 * (i + j * height)];
-        float y = gradients[2 * (i + j * height) + 1];
-        return Vec2(x,y);
-    };
+    const int width = 2048;
+    const int height = 2048;
 
-    for (int i = 0; i < width; ++ i) {
-        for (int j = 0; j < height; ++ j) {
-            float angle = rand01();
-            gradients[2 * (i + j * height)] = cos(2 * angle * M_PI);
-            gradients[2 * (i + j * height) + 1] = sin(2 * angle * M_PI);
-        }
-    }
+    // fBm parameters - Lunar
+    //   H = 0.8f, lacunarity = 4.0f, offset = 0.7f, octaves = 43
+    // or H = 0.25f, lacunarity = 2.0f, offset = 0.7f, octaves = 16
+    FractalParams params;
+    params.H = 0.9f;
+    params.lacunarity = 2.0f;
+    params.offset = 0.1f;
+    params.octaves = 5;
 
-    // Perlin Noise parameters
-    float frequency = 1.0f / period;
+    float *noise_data = HybridMultifractal2D(width, height, 512, seed, params);
 
-    float *perlin_data = new float[width*height];
-    for (int i = 0; i < width; ++ i) {
-        for (int j = 0; j < height; ++ j) {
+    R32FTexture* _tex = new R32FTexture();
+    _tex->upload_raw(width, height, noise_data);
 
-            // Integer coordinates of corners
-            int left = (i / period) * period;
-            int right = (left + period) % width;
-            int top = (j / period) * period;
-            int bottom = (top + period) % height;
+    // Clean up
+    delete[] noise_data;
 
-            //TODO: noise generation
-            float dx = (i - left) * frequency;
-            float dy = (j - top) * frequency;
+    return _tex;
+}
 
-            Vec2 topleft = sample_gradient(left, top);
-            Vec2 topright = sample_gradient(right, top);
-            Vec2 bottomleft = sample_gradient(left, bottom);
-            Vec2 bottomright = sample_gradient(right, bottom);
+float* perlin2D(const int width, const int height, const int period, const uint64_t seed) {
 
+    PerlinLattice lattice(width, height, period, seed);
 
+    float *perlin_data = new float[width*height];
+    noisePool().parallelFor(height, [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++ j) {
+            lattice.fillRow(j, 0, width, &perlin_data[(size_t) j * width]);
+        }
+    });
 
-            Vec2 a(dx, -dy); // topleft
-            Vec2 b(dx - 1, -dy); // topright
-            Vec2 c(dx, 1 - dy); // bottomleft
-            Vec2 d(dx - 1, 1 - dy); // bottomright
+    return perlin_data;
+}
 
+// Simplex counterpart of perlin2D: the field sampled at (i, j) / period
+float* simplex2D(const int width, const int height, const int period, const uint64_t seed) {
 
+    SimplexField field(seed);
+    const double step = 1.0 / period;
 
-            float s = topleft.dot(a);
-            float t = topright.dot(b);
-            float u = bottomleft.dot(c);
-            float v = bottomright.dot(d);
+    float *simplex_data = new float[width*height];
+    noisePool().parallelFor(height, [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++ j) {
+            field.fillRow(0.0, step, j * step, width, &simplex_data[(size_t) j * width]);
+        }
+    });
 
+    return simplex_data;
+}
 
+// Computes the w x h block at (x0, y0) of the width x height perlin2D field
+// into out (row stride outStride), independently of the rest of the field
+void perlin2DRegion(const int width, const int height, const int period, const uint64_t seed,
+                    const int x0, const int y0, const int w, const int h, float *out, const int outStride) {
 
-            float st = lerp(s, t, fade(dx));
-            float uv = lerp(u, v, fade(dx));
+    PerlinLattice lattice(width, height, period, seed);
+    for (int j = y0; j < y0 + h; ++ j) {
+        lattice.fillRow(j, x0, w, &out[(j - y0) * outStride]);
+    }
+}
 
+// Prints perlin2D throughput for every instruction set this CPU supports
+void reportPerlinThroughput(const int width=2048, const int height=2048, const int period=512) {
+    SimdLevel detected = detectSimdLevel();
+    SimdLevel previous = perlinSimdSetting();
 
+    for (int level = 0; level <= (int) detected; ++level) {
+        setPerlinSimdLevel((SimdLevel) level);
 
-            float noise = lerp(st, uv, fade(dy));
-            
+        auto start = std::chrono::high_resolution_clock::now();
+        float *data = perlin2D(width, height, period);
+        auto end = std::chrono::high_resolution_clock::now();
+        delete[] data;
 
-            perlin_data[i + j * height] = noise;
-        }
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::cout << "perlin2D [" << simdLevelName((SimdLevel) level) << "]: "
+                  << (width * (double) height) / seconds << " samples/s ("
+                  << seconds * 1000.0 << " ms, " << noisePool().size() << " threads)" << std::endl;
     }
 
-    delete gradients;
-    return perlin_data;
+    perlinSimdSetting() = previous;
 }
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "noise.h"
+
+// Terrain looks as small noise graphs instead of one generator function per
+// look. A node is a struct with
+//
+//   float operator()(double x, double y) const
+//
+// at a position in map units (the heightmap spans [0, 1)^2), and its inputs
+// are template parameters, so a whole graph inlines into one function of
+// (x, y). evaluateGraph2D calls it once per pixel: no node writes an
+// intermediate image. Frequencies are cycles per map, so a graph describes
+// the same terrain at any resolution.
+//
+//   FractalParams params = ...;
+//   auto hills = fBmNode(perlinNode(seed, 4.0), params);
+//   auto peaks = fBmNode(ridgedNode(perlinNode(seed + 1, 4.0)), params);
+//   auto mask = warpNode(simplexNode(seed + 2, 2.0), simplexNode(seed + 3, 8.0),
+//                        simplexNode(seed + 4, 8.0), 0.0625f);
+//   float *heights = evaluateGraph2D(2048, 2048, blendNode(hills, peaks, mask, -0.1f, 0.1f));
+
+// Sources
+
+// Perlin noise at any point, with table gradients hashed per lattice point.
+// Not wrapped, unlike perlin2D.
+struct PerlinNode {
+    uint64_t seed;
+    double frequency;
+
+    float operator()(double x, double y) const {
+        x *= frequency;
+        y *= frequency;
+        double fi = std::floor(x), fj = std::floor(y);
+        float dx = (float)(x - fi), dy = (float)(y - fj);
+        int i = (int) fi, j = (int) fj;
+
+        const float *g00 = gradient(i, j), *g10 = gradient(i + 1, j);
+        const float *g01 = gradient(i, j + 1), *g11 = gradient(i + 1, j + 1);
+        float s = g00[0] * dx + g00[1] * dy;
+        float t = g10[0] * (dx - 1) + g10[1] * dy;
+        float u = g01[0] * dx + g01[1] * (dy - 1);
+        float v = g11[0] * (dx - 1) + g11[1] * (dy - 1);
+
+        float fx = fade(dx);
+        return lerp(lerp(s, t, fx), lerp(u, v, fx), fade(dy));
+    }
+
+    const float *gradient(int i, int j) const {
+        uint64_t key = ((uint64_t)(uint32_t) i << 32) | (uint32_t) j;
+        return unitDirection(mix64(seed ^ mix64(key)));
+    }
+};
+
+struct SimplexNode {
+    SimplexField field;
+    double frequency;
+
+    float operator()(double x, double y) const {
+        return field.sample(x * frequency, y * frequency);
+    }
+};
+
+struct ConstantNode {
+    float value;
+
+    float operator()(double, double) const {
+        return value;
+    }
+};
+
+// Fractal drivers. Octave k samples the source at (x, y) * lacunarity^k,
+// shifted by k * octaveShift map units so octaves of one source do not line
+// up at the origin.
+
+template <typename Source>
+struct FBmNode {
+    Source source;
+    FractalParams params;
+    std::vector<float> exponents;
+
+    float operator()(double x, double y) const {
+        float noise = 0.0f;
+        double f = 1.0;
+        for (int k = 0; k < params.octaves; ++k) {
+            double shift = k * octaveShift;
+            noise += (source(x * f + shift, y * f + shift) + params.offset) * exponents[k];
+            f *= params.lacunarity;
+        }
+        return noise;
+    }
+};
+
+// Musgrave's hybrid multifractal: every octave is sampled, weighted by the
+// octaves before it. (HybridMultifractal2D only samples the first octave.)
+template <typename Source>
+struct HybridMultifractalNode {
+    Source source;
+    FractalParams params;
+    std::vector<float> exponents;
+
+    float operator()(double x, double y) const {
+        float noise = source(x, y) + params.offset;
+        float weight = noise;
+        double f = params.lacunarity;
+        for (int k = 1; k < params.octaves; ++k) {
+            weight = std::min(weight, 1.0f);
+            double shift = k * octaveShift;
+            float signal = (source(x * f + shift, y * f + shift) + params.offset) * exponents[k];
+            noise += weight * signal;
+            weight *= signal;
+            f *= params.lacunarity;
+        }
+        return noise;
+    }
+};
+
+// Shaping and arithmetic
+
+// 1 - |n|: sharp crests where n crosses zero
+template <typename Input>
+struct RidgedNode {
+    Input input;
+
+    float operator()(double x, double y) const {
+        return 1.0f - std::abs(input(x, y));
+    }
+};
+
+// 2|n| - 1: rounded lumps with creases between them
+template <typename Input>
+struct BillowNode {
+    Input input;
+
+    float operator()(double x, double y) const {
+        return 2.0f * std::abs(input(x, y)) - 1.0f;
+    }
+};
+
+template <typename Input>
+struct ScaleBiasNode {
+    Input input;
+    float scale;
+    float bias;
+
+    float operator()(double x, double y) const {
+        return input(x, y) * scale + bias;
+    }
+};
+
+template <typename A, typename B>
+struct AddNode {
+    A a;
+    B b;
+
+    float operator()(double x, double y) const {
+        return a(x, y) + b(x, y);
+    }
+};
+
+template <typename A, typename B>
+struct MulNode {
+    A a;
+    B b;
+
+    float operator()(double x, double y) const {
+        return a(x, y) * b(x, y);
+    }
+};
+
+// a where the control is below lower, b above upper, smoothstep between.
+// Only the inputs the weight needs are evaluated.
+template <typename A, typename B, typename Control>
+struct BlendNode {
+    A a;
+    B b;
+    Control control;
+    float lower;
+    float upper;
+
+    float operator()(double x, double y) const {
+        float t = (control(x, y) - lower) / (upper - lower);
+        t = std::min(std::max(t, 0.0f), 1.0f);
+        t = cubicFade(t);
+        if (t == 0.0f) return a(x, y);
+        if (t == 1.0f) return b(x, y);
+        return lerp(a(x, y), b(x, y), t);
+    }
+};
+
+// Domain warp: the input sampled at (x, y) + amount * (warpX, warpY)
+template <typename Input, typename WarpX, typename WarpY>
+struct WarpNode {
+    Input input;
+    WarpX warpX;
+    WarpY warpY;
+    float amount;
+
+    float operator()(double x, double y) const {
+        return input(x + amount * warpX(x, y), y + amount * warpY(x, y));
+    }
+};
+
+// Builders, so graphs can be written as nested calls
+
+inline PerlinNode perlinNode(const uint64_t seed, const double frequency) {
+    return PerlinNode{ seed, frequency };
+}
+
+inline SimplexNode simplexNode(const uint64_t seed, const double frequency) {
+    return SimplexNode{ SimplexField(seed), frequency };
+}
+
+inline ConstantNode constantNode(const float value) {
+    return ConstantNode{ value };
+}
+
+template <typename Source>
+FBmNode<Source> fBmNode(const Source &source, const FractalParams &params) {
+    return FBmNode<Source>{ source, params, fractalExponents(params) };
+}
+
+template <typename Source>
+HybridMultifractalNode<Source> hybridMultifractalNode(const Source &source, const FractalParams &params) {
+    return HybridMultifractalNode<Source>{ source, params, fractalExponents(params) };
+}
+
+template <typename Input>
+RidgedNode<Input> ridgedNode(const Input &input) {
+    return RidgedNode<Input>{ input };
+}
+
+template <typename Input>
+BillowNode<Input> billowNode(const Input &input) {
+    return BillowNode<Input>{ input };
+}
+
+template <typename Input>
+ScaleBiasNode<Input> scaleBiasNode(const Input &input, const float scale, const float bias) {
+    return ScaleBiasNode<Input>{ input, scale, bias };
+}
+
+template <typename A, typename B>
+AddNode<A, B> addNode(const A &a, const B &b) {
+    return AddNode<A, B>{ a, b };
+}
+
+template <typename A, typename B>
+MulNode<A, B> mulNode(const A &a, const B &b) {
+    return MulNode<A, B>{ a, b };
+}
+
+template <typename A, typename B, typename Control>
+BlendNode<A, B, Control> blendNode(const A &a, const B &b, const Control &control, const float lower, const float upper) {
+    return BlendNode<A, B, Control>{ a, b, control, lower, upper };
+}
+
+template <typename Input, typename WarpX, typename WarpY>
+WarpNode<Input, WarpX, WarpY> warpNode(const Input &input, const WarpX &warpX, const WarpY &warpY, const float amount) {
+    return WarpNode<Input, WarpX, WarpY>{ input, warpX, warpY, amount };
+}
+
+// width x height heights of a graph, sample (i, j) at data[i + j * width]
+// taken at map position (i / width, j / height)
+template <typename Graph>
+float* evaluateGraph2D(const int width, const int height, const Graph &graph) {
+    const double du = 1.0 / width, dv = 1.0 / height;
+    return fractal2D(width, height, [&](int j, float *row, FractalScratch &) {
+        for (int i = 0; i < width; ++i) {
+            row[i] = graph(i * du, j * dv);
+        }
+    });
+}
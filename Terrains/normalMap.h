@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "fractalPresets.h"
+
+// Terrain normals computed once on the CPU and stored octahedral-encoded in
+// an RG16 snorm texture, so the shaders fetch one texel instead of rebuilding
+// the normal from four heights.
+//
+// Normals face up and use the shaders' units: x, y in uv units, z in height
+// units, so the normal at a texel with height gradient (gx, gy) per texel and
+// texel spacing t (uv units) is normalize(-gx / t, -gy / t, 1).
+
+using RG16SnormTexture = Texture<GL_RG16_SNORM, GL_RG, GL_SHORT>;
+
+// Unit vector to the [-1, 1]^2 octahedral square: project onto |x|+|y|+|z| = 1
+// and fold the lower half over the diagonals
+inline void octahedralEncode(float x, float y, float z, int16_t *out) {
+    float l1 = std::abs(x) + std::abs(y) + std::abs(z);
+    float u = x / l1, v = y / l1;
+    if (z < 0.0f) {
+        float fu = (1.0f - std::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float fv = (1.0f - std::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = fu;
+        v = fv;
+    }
+    out[0] = (int16_t) std::floor(u * 32767.0f + 0.5f);
+    out[1] = (int16_t) std::floor(v * 32767.0f + 0.5f);
+}
+
+inline Vec3 octahedralDecode(const int16_t *in) {
+    float u = std::max(in[0] / 32767.0f, -1.0f), v = std::max(in[1] / 32767.0f, -1.0f);
+    float z = 1.0f - std::abs(u) - std::abs(v);
+    if (z < 0.0f) {
+        float fu = (1.0f - std::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float fv = (1.0f - std::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = fu;
+        v = fv;
+    }
+    return Vec3(u, v, z).normalized();
+}
+
+struct NormalMap {
+    int width = 0;
+    int height = 0;
+    bool analytic = false;          // from noise derivatives rather than a Sobel pass
+    std::vector<int16_t> texels;    // two per texel, laid out like the heightmap
+
+    const int16_t *data() const { return texels.data(); }
+
+    Vec3 normal(const int i, const int j) const {
+        return octahedralDecode(&texels[2 * ((size_t) i + (size_t) j * width)]);
+    }
+};
+
+inline void encodeGradient(float gx, float gy, float texel, int16_t *out) {
+    float x = -gx / texel, y = -gy / texel;
+    float l = std::sqrt(x * x + y * y + 1.0f);
+    octahedralEncode(x / l, y / l, 1.0f / l, out);
+}
+
+// Normals of a width x height heightmap from the 3x3 Sobel gradient, edges
+// clamped like the texture; texel is the spacing of samples in uv units.
+// Rows run on pool, or on the calling thread when pool == nullptr.
+inline void sobelNormals(const float *heights, const int width, const int height, const float texel, int16_t *out,
+                         WorkerPool *pool = nullptr) {
+    auto rows = [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++j) {
+            const float *up = &heights[(size_t) std::max(j - 1, 0) * width];
+            const float *mid = &heights[(size_t) j * width];
+            const float *down = &heights[(size_t) std::min(j + 1, height - 1) * width];
+            for (int i = 0; i < width; ++i) {
+                int l = std::max(i - 1, 0), r = std::min(i + 1, width - 1);
+                float gx = (up[r] + 2 * mid[r] + down[r]) - (up[l] + 2 * mid[l] + down[l]);
+                float gy = (down[l] + 2 * down[i] + down[r]) - (up[l] + 2 * up[i] + up[r]);
+                encodeGradient(gx / 8, gy / 8, texel, &out[2 * ((size_t) i + (size_t) j * width)]);
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(height, rows);
+    } else {
+        rows(0, height);
+    }
+}
+
+inline NormalMap sobelNormalMap(const float *heights, const int width, const int height) {
+    NormalMap normals;
+    normals.width = width;
+    normals.height = height;
+    normals.texels.resize(2 * (size_t) width * height);
+    sobelNormals(heights, width, height, 1.0f / width, normals.texels.data(), &noisePool());
+    return normals;
+}
+
+// Whether a preset's heights have analytic normals: the Perlin fBm and Hybrid
+// Multifractal drivers without erosion. fBm needs every octave to span at
+// least four pixels, since derivatives of aliased octaves are meaningless;
+// the hybrid recursion only reads the first octave, so it always qualifies.
+inline bool hasAnalyticNormals(const FractalPreset &preset, const FractalParams &params, const int period,
+                               const bool eroded) {
+    if (eroded || preset.compose || preset.basis != NoiseBasis::Perlin) return false;
+    if (preset.hybrid) return true;
+    return std::pow(params.lacunarity, (float)(params.octaves - 1)) * 4.0f <= period;
+}
+
+// Normals of generate2D(width, height, period, seed) with params, from the
+// derivatives of the noise (chain rule through the octave sum or the hybrid
+// weight recursion) instead of differences of the stored heights
+inline NormalMap analyticNormalMap(const FractalPreset &preset, const FractalParams &params, const uint64_t seed,
+                                   const int width, const int height, const int period) {
+    NormalMap normals;
+    normals.width = width;
+    normals.height = height;
+    normals.analytic = true;
+    normals.texels.resize(2 * (size_t) width * height);
+
+    PerlinLattice lattice(width, height, period, seed, preset.cubicFade ? cubicFade : fade,
+                          preset.cubicFade ? cubicFadeSlope : fadeSlope);
+    std::vector<float> exponents = fractalExponents(params);
+    const int lacunarity = (int) params.lacunarity;
+    const float texel = 1.0f / width;
+
+    noisePool().parallelFor(height, [&](int rowBegin, int rowEnd) {
+        std::vector<PerlinLattice::Row> rows(params.octaves);
+        for (int j = rowBegin; j < rowEnd; ++j) {
+
+            // Octave k is the base field at (i, j) * lacunarity^k, wrapped
+            int J = j % height;
+            for (int k = 0; k < params.octaves; ++k) {
+                rows[k] = lattice.row(J);
+                J = (int)(((int64_t) J * lacunarity) % height);
+            }
+
+            for (int i = 0; i < width; ++i) {
+                float gx = 0.0f, gy = 0.0f;
+
+                if (preset.hybrid) {
+                    // perlin = 1 - |n|, then the recursion of hybridMultifractalFromBase
+                    const PerlinLattice::Row &r = rows[0];
+                    float n = lattice.sample(r, i), nx, ny;
+                    lattice.sampleGradient(r, i, nx, ny);
+                    float sign = n >= 0.0f ? -1.0f : 1.0f;
+                    float perlin = 1 - std::abs(n), px = sign * nx, py = sign * ny;
+                    float weight = perlin, wx = px, wy = py;
+                    for (int k = 1; k < params.octaves; ++k) {
+                        if (weight > 1.0f) {
+                            weight = 1.0f;
+                            wx = wy = 0.0f;
+                        }
+                        float signal = (perlin + params.offset) * exponents[k];
+                        float sx = px * exponents[k], sy = py * exponents[k];
+                        px += wx * signal + weight * sx;
+                        py += wy * signal + weight * sy;
+                        wx = wx * signal + weight * sx;
+                        wy = wy * signal + weight * sy;
+                        perlin += weight * signal;
+                        weight *= signal;
+                    }
+                    gx = px;
+                    gy = py;
+                } else {
+                    int column = i;
+                    float scale = 1.0f;
+                    for (int k = 0; k < params.octaves; ++k) {
+                        float nx, ny;
+                        lattice.sampleGradient(rows[k], column, nx, ny);
+                        gx += nx * scale * exponents[k];
+                        gy += ny * scale * exponents[k];
+                        column = (int)(((int64_t) column * lacunarity) % width);
+                        scale *= lacunarity;
+                    }
+                }
+
+                encodeGradient(gx, gy, texel, &normals.texels[2 * ((size_t) i + (size_t) j * width)]);
+            }
+        }
+    });
+    return normals;
+}
+
+// Normals for the fixed map: analytic when the preset allows it, otherwise a
+// Sobel pass over the heights as stored
+inline NormalMap terrainNormalMap(const FractalPreset &preset, const FractalParams &params, const uint64_t seed,
+                                  const int period, const bool eroded, const float *heights,
+                                  const int width, const int height) {
+    if (hasAnalyticNormals(preset, params, period, eroded)) {
+        return analyticNormalMap(preset, params, seed, width, height, period);
+    }
+    return sobelNormalMap(heights, width, height);
+}
+
+inline RG16SnormTexture* uploadNormalTexture(const int width, const int height, const int16_t *texels) {
+    RG16SnormTexture *tex = new RG16SnormTexture();
+    tex->upload_raw(width, height, texels);
+    return tex;
+}
+
+inline RG16SnormTexture* uploadNormalTexture(const NormalMap &normals) {
+    return uploadNormalTexture(normals.width, normals.height, normals.data());
+}
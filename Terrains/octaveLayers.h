@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "noise.h"
+
+// Per-octave layer cache for tuning fractal parameters interactively.
+//
+// Octave k of fBm2D is the base perlin field sampled at (i, j) * lacunarity^k,
+// which depends on the seed, period and lacunarity but not on H, offset or the
+// octave count. The layers are kept as int16 snorm (2 bytes per sample), so
+// changing H or offset is one weighted sum over the layers and adding an
+// octave computes only the new layer. The hybrid multifractal only reads the
+// first octave's sample, so it needs a single layer whatever its parameters.
+//
+// Once lacunarity^k wraps to 0 along an axis, octave k and every octave after
+// it are constant along that axis: those layers keep one column, one row or
+// (when both wrap, as on square power-of-two maps) a single value.
+//
+// Quantisation error is at most 0.5 / 32767 per layer sample, i.e. about
+// 1.5e-5 times the sum of the exponents in the final height.
+
+// Perlin samples are within [-sqrt(2)/2, sqrt(2)/2], so [-1, 1] maps to int16
+const float octaveLayerScale = 32767.0f;
+
+// out[i] += layer[i] * w over a row, on the instruction set perlin2D uses
+inline void accumulateLayerScalar(float *out, const int16_t *layer, float w, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+        out[i] += layer[i] * w;
+    }
+}
+
+#ifdef PERLIN_X86
+
+PERLIN_TARGET("sse4.2")
+inline void accumulateLayerSSE42(float *out, const int16_t *layer, float w, int n) {
+    const __m128 vw = _mm_set1_ps(w);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i q = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *) &layer[i]));
+        __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(q), vw);
+        _mm_storeu_ps(&out[i], _mm_add_ps(_mm_loadu_ps(&out[i]), v));
+    }
+    accumulateLayerScalar(out, layer, w, i, n);
+}
+
+PERLIN_TARGET("avx2")
+inline void accumulateLayerAVX2(float *out, const int16_t *layer, float w, int n) {
+    const __m256 vw = _mm256_set1_ps(w);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i q = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &layer[i]));
+        __m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(q), vw);
+        _mm256_storeu_ps(&out[i], _mm256_add_ps(_mm256_loadu_ps(&out[i]), v));
+    }
+    accumulateLayerScalar(out, layer, w, i, n);
+}
+
+#endif // PERLIN_X86
+
+inline void accumulateLayer(float *out, const int16_t *layer, float w, int n) {
+    switch (perlinSimdSetting()) {
+#ifdef PERLIN_X86
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2: accumulateLayerAVX2(out, layer, w, n); return;
+        case SimdLevel::SSE42: accumulateLayerSSE42(out, layer, w, n); return;
+#endif
+        default: accumulateLayerScalar(out, layer, w, 0, n); return;
+    }
+}
+
+class OctaveLayers {
+public:
+
+    OctaveLayers(const int width, const int height, const int period, const uint64_t seed,
+                 const int lacunarity, float (*curve)(float) = fade)
+        : width(width), height(height), lacunarity(lacunarity),
+          lattice(width, height, period, seed, curve) {}
+
+    // Computes the layers below octaves that are not cached yet
+    void ensure(const int octaves) {
+        while ((int) layers.size() < octaves) {
+            addLayer((int) layers.size());
+        }
+    }
+
+    int count() const { return (int) layers.size(); }
+
+    size_t bytes() const {
+        size_t samples = 0;
+        for (size_t k = 0; k < layers.size(); ++k) {
+            samples += layers[k].samples.size();
+        }
+        return samples * sizeof(int16_t);
+    }
+
+    // Same heights as fBm2D with these params (up to quantisation); the
+    // lacunarity must be the one the layers were built with
+    float* fBm(const FractalParams &params) {
+        ensure(params.octaves);
+        std::vector<float> exponents = fractalExponents(params);
+
+        // sum_k (perlin_k + offset) e_k = sum_k perlin_k e_k + offset sum_k e_k
+        std::vector<float> weights(params.octaves);
+        float bias = 0.0f;
+        for (int k = 0; k < params.octaves; ++k) {
+            weights[k] = exponents[k] / octaveLayerScale;
+            bias += params.offset * exponents[k];
+        }
+
+        float *noise_data = new float[width * height];
+        noisePool().parallelFor(height, [&](int rowBegin, int rowEnd) {
+            for (int j = rowBegin; j < rowEnd; ++j) {
+                // Layers constant along the row only add to its bias
+                float rowBias = bias;
+                for (int k = 0; k < params.octaves; ++k) {
+                    if (layers[k].strideI == 0) rowBias += layers[k].row(j)[0] * weights[k];
+                }
+                float *out = &noise_data[(size_t) j * width];
+                for (int i = 0; i < width; ++i) {
+                    out[i] = rowBias;
+                }
+                // Octave-major; the row stays in L1 across octaves
+                for (int k = 0; k < params.octaves; ++k) {
+                    if (layers[k].strideI != 0) accumulateLayer(out, layers[k].row(j), weights[k], width);
+                }
+            }
+        });
+        return noise_data;
+    }
+
+    // Same heights as HybridMultifractal2D with these params (up to quantisation)
+    float* hybridMultifractal(const FractalParams &params) {
+        ensure(1);
+        std::vector<float> exponents = fractalExponents(params);
+
+        float *noise_data = new float[width * height];
+        noisePool().parallelFor(height, [&](int rowBegin, int rowEnd) {
+            for (int j = rowBegin; j < rowEnd; ++j) {
+                const int16_t *layer = layers[0].row(j);
+                const int strideI = layers[0].strideI;
+                for (int i = 0; i < width; ++i) {
+                    float perlin = 1 - std::abs(layer[i * strideI] / octaveLayerScale);
+                    float weight = perlin;
+                    for (int k = 1; k < params.octaves; k++) {
+                        if (weight > 1.0) {
+                            weight = 1.0;
+                        }
+                        float signal = (perlin + params.offset) * exponents[k];
+                        perlin += weight * signal;
+                        weight *= signal;
+                    }
+                    noise_data[i + (size_t) j * width] = perlin;
+                }
+            }
+        });
+        return noise_data;
+    }
+
+    const int width;
+    const int height;
+    const int lacunarity;
+
+private:
+
+    // Octave k at sample (i, j) is samples[i * strideI + j * strideJ]; a
+    // stride is 0 along an axis the octave is constant on
+    struct Layer {
+        std::vector<int16_t> samples;
+        int strideI = 1;
+        int strideJ = 0;
+
+        const int16_t *row(const int j) const { return &samples[(size_t) j * strideJ]; }
+    };
+
+    void addLayer(const int k) {
+        // Row and column steps of octave k: lacunarity^k, wrapped to the field
+        int rowStep = 1;
+        int step = 1;
+        for (int o = 0; o < k; ++o) {
+            rowStep = (rowStep * lacunarity) % height;
+            step = (step * lacunarity) % width;
+        }
+
+        Layer layer;
+        const int columns = step == 0 ? 1 : width, rows = rowStep == 0 ? 1 : height;
+        layer.strideI = step == 0 ? 0 : 1;
+        layer.strideJ = rowStep == 0 ? 0 : columns;
+        layer.samples.resize((size_t) columns * rows);
+        noisePool().parallelFor(rows, [&](int rowBegin, int rowEnd) {
+            std::vector<float> base(width);
+            for (int j = rowBegin; j < rowEnd; ++j) {
+                int J = (int)((int64_t) j * rowStep % height);
+                lattice.fillRow(J, 0, width, base.data());
+
+                int16_t *out = &layer.samples[(size_t) j * columns];
+                int column = 0;
+                for (int i = 0; i < columns; ++i) {
+                    float q = std::floor(base[column] * octaveLayerScale + 0.5f);
+                    out[i] = (int16_t) std::max(-octaveLayerScale, std::min(octaveLayerScale, q));
+                    column += step;
+                    if (column >= width) column -= width;
+                }
+            }
+        });
+        layers.push_back(std::move(layer));
+    }
+
+    PerlinLattice lattice;
+    std::vector<Layer> layers;
+};
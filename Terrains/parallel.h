@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads used by the heightmap generators.
+// Work is handed out as contiguous bands of rows; every row is written by
+// exactly one thread, so results never depend on the thread count.
+class WorkerPool {
+public:
+
+    explicit WorkerPool(int threads) {
+        if (threads <= 0) {
+            threads = (int) std::thread::hardware_concurrency();
+        }
+        threads = std::max(1, threads);
+
+        // The calling thread takes part in every job, so spawn one less
+        for (int t = 1; t < threads; ++t) {
+            workers.push_back(std::thread([this]() { workerLoop(); }));
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool &operator=(const WorkerPool&) = delete;
+
+    int size() const { return (int) workers.size() + 1; }
+
+    // Calls fn(begin, end) over [0, count) in bands of at most grain rows
+    // and blocks until every band is finished
+    void parallelFor(int count, const std::function<void(int, int)> &fn, int grain = 16) {
+        if (count <= 0) return;
+        grain = std::max(1, grain);
+
+        if (workers.empty() || count <= grain) {
+            fn(0, count);
+            return;
+        }
+
+        // Only one job runs at a time
+        std::lock_guard<std::mutex> jobLock(jobMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            jobCount = count;
+            jobGrain = grain;
+            next = 0;
+            busy = (int) workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+
+        runBands(fn, count, grain);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return busy == 0; });
+        job = nullptr;
+    }
+
+private:
+
+    void runBands(const std::function<void(int, int)> &fn, int count, int grain) {
+        for (;;) {
+            int begin = next.fetch_add(grain);
+            if (begin >= count) break;
+            fn(begin, std::min(begin + grain, count));
+        }
+    }
+
+    void workerLoop() {
+        unsigned seen = 0;
+        for (;;) {
+            const std::function<void(int, int)> *fn;
+            int count, grain;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                fn = job;
+                count = jobCount;
+                grain = jobGrain;
+            }
+
+            runBands(*fn, count, grain);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --busy;
+            }
+            done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    std::mutex jobMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(int, int)> *job = nullptr;
+    int jobCount = 0;
+    int jobGrain = 1;
+    std::atomic<int> next{0};
+    int busy = 0;
+    unsigned generation = 0;
+    bool stopping = false;
+};
+
+// Thread count for the generators in noise.h (0 = one per hardware thread)
+inline int &noiseThreadSetting() {
+    static int threads = 0;
+    return threads;
+}
+
+// A pool with the configured thread count, created on first use and again
+// whenever the setting has changed since
+class ConfiguredPool {
+public:
+
+    WorkerPool &get() {
+        if (!pool || poolThreads != noiseThreadSetting()) {
+            pool.reset(new WorkerPool(noiseThreadSetting()));
+            poolThreads = noiseThreadSetting();
+        }
+        return *pool;
+    }
+
+private:
+    std::unique_ptr<WorkerPool> pool;
+    int poolThreads = -1;
+};
+
+// Shared pool of the generators
+inline WorkerPool &noisePool() {
+    static ConfiguredPool pool;
+    return pool.get();
+}
+
+// Pool for work the render thread waits on, such as rebuilding what is
+// derived from the heights when a new heightmap is swapped in. noisePool
+// may be running a background heightmap level for seconds, and its jobs
+// run one at a time.
+inline WorkerPool &renderPool() {
+    static ConfiguredPool pool;
+    return pool.get();
+}
+
+inline void setNoiseThreads(int threads) {
+    noiseThreadSetting() = std::max(0, threads);
+}
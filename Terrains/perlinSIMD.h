@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define PERLIN_X86 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+// GCC and Clang need the ISA enabled per function; MSVC always allows intrinsics.
+// Contraction into FMA is disabled as well (AVX-512 implies FMA), otherwise
+// the wide paths would round differently from the scalar one.
+#if defined(PERLIN_X86) && defined(__clang__)
+    #define PERLIN_TARGET(isa) __attribute__((target(isa)))
+    #define PERLIN_NO_CONTRACT _Pragma("clang fp contract(off)")
+#elif defined(PERLIN_X86) && defined(__GNUC__)
+    #define PERLIN_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+    #define PERLIN_NO_CONTRACT
+#else
+    #define PERLIN_TARGET(isa)
+    #define PERLIN_NO_CONTRACT
+#endif
+
+// Instruction sets the perlin row kernel is compiled for
+enum class SimdLevel { Scalar = 0, SSE42 = 1, AVX2 = 2, AVX512 = 3 };
+
+inline const char *simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE42: return "sse4.2";
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+// A run of pixels of one row that lie in the same lattice cell shares the
+// four corner gradients g = {tl.x, tl.y, tr.x, tr.y, bl.x, bl.y, br.x, br.y}
+// and dy/fade(dy); only dx and fade(dx) vary along the run.
+
+// The SIMD kernels below perform exactly the same float operations in the
+// same order as this one, so every path produces bit-identical samples
+inline void perlinRunScalar(const float *g, const float *dx, const float *fx, float dy, float fy,
+                            float *out, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+        float s = g[0] * dx[i] + g[1] * (-dy);
+        float t = g[2] * (dx[i] - 1) + g[3] * (-dy);
+        float u = g[4] * dx[i] + g[5] * (1 - dy);
+        float v = g[6] * (dx[i] - 1) + g[7] * (1 - dy);
+
+        float st = s + fx[i] * (t - s);
+        float uv = u + fx[i] * (v - u);
+        out[i] = st + fy * (uv - st);
+    }
+}
+
+#ifdef PERLIN_X86
+
+PERLIN_TARGET("sse4.2")
+inline void perlinRunSSE42(const float *g, const float *dx, const float *fx, float dy, float fy, float *out, int n) {
+    PERLIN_NO_CONTRACT
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 ndy = _mm_set1_ps(-dy);
+    const __m128 pdy = _mm_set1_ps(1 - dy);
+    const __m128 vfy = _mm_set1_ps(fy);
+    __m128 gv[8];
+    for (int k = 0; k < 8; ++k) gv[k] = _mm_set1_ps(g[k]);
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(&dx[i]);
+        __m128 x1 = _mm_sub_ps(x, one);
+        __m128 f = _mm_loadu_ps(&fx[i]);
+
+        __m128 s = _mm_add_ps(_mm_mul_ps(gv[0], x), _mm_mul_ps(gv[1], ndy));
+        __m128 t = _mm_add_ps(_mm_mul_ps(gv[2], x1), _mm_mul_ps(gv[3], ndy));
+        __m128 u = _mm_add_ps(_mm_mul_ps(gv[4], x), _mm_mul_ps(gv[5], pdy));
+        __m128 v = _mm_add_ps(_mm_mul_ps(gv[6], x1), _mm_mul_ps(gv[7], pdy));
+
+        __m128 st = _mm_add_ps(s, _mm_mul_ps(f, _mm_sub_ps(t, s)));
+        __m128 uv = _mm_add_ps(u, _mm_mul_ps(f, _mm_sub_ps(v, u)));
+        _mm_storeu_ps(&out[i], _mm_add_ps(st, _mm_mul_ps(vfy, _mm_sub_ps(uv, st))));
+    }
+    perlinRunScalar(g, dx, fx, dy, fy, out, i, n);
+}
+
+PERLIN_TARGET("avx2")
+inline void perlinRunAVX2(const float *g, const float *dx, const float *fx, float dy, float fy, float *out, int n) {
+    PERLIN_NO_CONTRACT
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 ndy = _mm256_set1_ps(-dy);
+    const __m256 pdy = _mm256_set1_ps(1 - dy);
+    const __m256 vfy = _mm256_set1_ps(fy);
+    __m256 gv[8];
+    for (int k = 0; k < 8; ++k) gv[k] = _mm256_set1_ps(g[k]);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(&dx[i]);
+        __m256 x1 = _mm256_sub_ps(x, one);
+        __m256 f = _mm256_loadu_ps(&fx[i]);
+
+        __m256 s = _mm256_add_ps(_mm256_mul_ps(gv[0], x), _mm256_mul_ps(gv[1], ndy));
+        __m256 t = _mm256_add_ps(_mm256_mul_ps(gv[2], x1), _mm256_mul_ps(gv[3], ndy));
+        __m256 u = _mm256_add_ps(_mm256_mul_ps(gv[4], x), _mm256_mul_ps(gv[5], pdy));
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(gv[6], x1), _mm256_mul_ps(gv[7], pdy));
+
+        __m256 st = _mm256_add_ps(s, _mm256_mul_ps(f, _mm256_sub_ps(t, s)));
+        __m256 uv = _mm256_add_ps(u, _mm256_mul_ps(f, _mm256_sub_ps(v, u)));
+        _mm256_storeu_ps(&out[i], _mm256_add_ps(st, _mm256_mul_ps(vfy, _mm256_sub_ps(uv, st))));
+    }
+    perlinRunScalar(g, dx, fx, dy, fy, out, i, n);
+}
+
+PERLIN_TARGET("avx512f")
+inline void perlinRunAVX512(const float *g, const float *dx, const float *fx, float dy, float fy, float *out, int n) {
+    PERLIN_NO_CONTRACT
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 ndy = _mm512_set1_ps(-dy);
+    const __m512 pdy = _mm512_set1_ps(1 - dy);
+    const __m512 vfy = _mm512_set1_ps(fy);
+    __m512 gv[8];
+    for (int k = 0; k < 8; ++k) gv[k] = _mm512_set1_ps(g[k]);
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(&dx[i]);
+        __m512 x1 = _mm512_sub_ps(x, one);
+        __m512 f = _mm512_loadu_ps(&fx[i]);
+
+        __m512 s = _mm512_add_ps(_mm512_mul_ps(gv[0], x), _mm512_mul_ps(gv[1], ndy));
+        __m512 t = _mm512_add_ps(_mm512_mul_ps(gv[2], x1), _mm512_mul_ps(gv[3], ndy));
+        __m512 u = _mm512_add_ps(_mm512_mul_ps(gv[4], x), _mm512_mul_ps(gv[5], pdy));
+        __m512 v = _mm512_add_ps(_mm512_mul_ps(gv[6], x1), _mm512_mul_ps(gv[7], pdy));
+
+        __m512 st = _mm512_add_ps(s, _mm512_mul_ps(f, _mm512_sub_ps(t, s)));
+        __m512 uv = _mm512_add_ps(u, _mm512_mul_ps(f, _mm512_sub_ps(v, u)));
+        _mm512_storeu_ps(&out[i], _mm512_add_ps(st, _mm512_mul_ps(vfy, _mm512_sub_ps(uv, st))));
+    }
+    perlinRunScalar(g, dx, fx, dy, fy, out, i, n);
+}
+
+inline void cpuid(int leaf, int subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int k = 0; k < 4; ++k) regs[k] = (unsigned) r[k];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// XCR0: which register files the OS saves on context switch
+inline unsigned long long readXCR0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long) hi << 32) | lo;
+#endif
+}
+
+#endif // PERLIN_X86
+
+// Best instruction set supported by both the CPU and the OS
+inline SimdLevel detectSimdLevel() {
+#ifdef PERLIN_X86
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    unsigned maxLeaf = regs[0];
+
+    cpuid(1, 0, regs);
+    bool sse42 = (regs[2] >> 20) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool avx = (regs[2] >> 28) & 1;
+    if (!sse42) return SimdLevel::Scalar;
+    if (!osxsave || !avx || maxLeaf < 7) return SimdLevel::SSE42;
+
+    unsigned long long xcr0 = readXCR0();
+    bool ymmState = (xcr0 & 0x6) == 0x6;
+    bool zmmState = (xcr0 & 0xe6) == 0xe6;
+
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] >> 5) & 1;
+    bool avx512f = (regs[1] >> 16) & 1;
+
+    if (avx512f && zmmState) return SimdLevel::AVX512;
+    if (avx2 && ymmState) return SimdLevel::AVX2;
+    return SimdLevel::SSE42;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+// Level used by perlin2D; can be lowered (never raised above the detected
+// level) to compare the paths
+inline SimdLevel &perlinSimdSetting() {
+    static SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+inline void setPerlinSimdLevel(SimdLevel level) {
+    perlinSimdSetting() = std::min(level, detectSimdLevel());
+}
+
+inline void perlinRun(const float *g, const float *dx, const float *fx, float dy, float fy, float *out, int n) {
+    switch (perlinSimdSetting()) {
+#ifdef PERLIN_X86
+        case SimdLevel::AVX512: perlinRunAVX512(g, dx, fx, dy, fy, out, n); return;
+        case SimdLevel::AVX2: perlinRunAVX2(g, dx, fx, dy, fy, out, n); return;
+        case SimdLevel::SSE42: perlinRunSSE42(g, dx, fx, dy, fy, out, n); return;
+#endif
+        default: perlinRunScalar(g, dx, fx, dy, fy, out, 0, n); return;
+    }
+}
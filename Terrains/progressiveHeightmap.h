@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "heightmapCache.h"
+#include "heightPyramid.h"
+#include "normalMap.h"
+#include "terrainLod.h"
+
+// Background generation of the fixed 2048^2 map, so the window opens before
+// the heights exist. The worker delivers coarse previews first (256^2, then
+// 1024^2), then the full map; each level arrives with everything built that
+// does not need GL: quantized heights, normals, height pyramid and the
+// terrain modes' TerrainLod. Swapping it in on the main thread only creates
+// the GL objects (height and normal textures, the meshes of the mode being
+// drawn) and swaps pointers.
+
+// Heights of the fixed map at every (2048 / size)-th sample, without the rest:
+// a preview shows the terrain the full map will have, only coarser. Erosion
+// is not applied.
+inline float* presetPreview2D(const FractalPreset &preset, const uint64_t seed, const int size) {
+    const int stride = 2048 / size;
+
+    // Graphs and simplex octaves scale with the period: sampling (i, j) at
+    // period / stride is sampling (i, j) * stride at period
+    if (preset.compose || preset.basis == NoiseBasis::Simplex) {
+        return preset.generate2D(size, size, 512 / stride, seed);
+    }
+
+    // Perlin octaves are the 2048^2 base field wrapped, so take its samples
+    // directly; the hybrid recursion only needs the first octave
+    const FractalParams &params = preset.params;
+    PerlinLattice lattice(2048, 2048, 512, seed, preset.cubicFade ? cubicFade : fade);
+    std::vector<float> exponents = fractalExponents(params);
+    const int64_t lacunarity = (int64_t) params.lacunarity;
+    const int octaves = preset.hybrid ? 1 : params.octaves;
+
+    return fractal2D(size, size, [&](int j, float *row, FractalScratch &scratch) {
+        std::vector<PerlinLattice::Row> rows(octaves);
+        std::vector<int64_t> steps(octaves);
+        int64_t J = (int64_t) j * stride % 2048, step = stride;
+        for (int k = 0; k < octaves; ++k) {
+            rows[k] = lattice.row((int) J);
+            steps[k] = step;
+            J = J * lacunarity % 2048;
+            step = step * lacunarity % 2048;
+        }
+
+        if (preset.hybrid) {
+            scratch.rows.resize(size);
+            for (int i = 0; i < size; ++i) {
+                scratch.rows[i] = lattice.sample(rows[0], (int)(i * steps[0] % 2048));
+            }
+            hybridMultifractalFromBase(scratch.rows.data(), params, exponents.data(), size, row);
+            return;
+        }
+        for (int i = 0; i < size; ++i) {
+            float noise = 0.0f;
+            for (int k = 0; k < octaves; ++k) {
+                noise += (lattice.sample(rows[k], (int)(i * steps[k] % 2048)) + params.offset) * exponents[k];
+            }
+            row[i] = noise;
+        }
+    });
+}
+
+// One finished level, ready to swap in
+struct HeightmapLevel {
+    QuantizedHeightmap heights;
+    NormalMap normals;
+    std::unique_ptr<HeightPyramid> pyramid;
+    TerrainLod lod;                 // built from pyramid
+    bool final = false;
+    double ms = 0.0;        // since generation started
+};
+
+class ProgressiveHeightmap {
+public:
+
+    // cacheDirectory empty: always generate. A cache hit skips the previews.
+    // Each level's TerrainLod is built with lodSettings.
+    ProgressiveHeightmap(const FractalPreset &preset, const uint64_t seed, HeightmapFormat format,
+                         const ErosionParams &erosion, const std::string &cacheDirectory,
+                         const TerrainLodSettings &lodSettings,
+                         const std::vector<int> &previewSizes = std::vector<int>{ 256, 1024 })
+        : preset(preset), seed(seed), format(format), erosion(erosion), cacheDirectory(cacheDirectory),
+          lodSettings(lodSettings), previewSizes(previewSizes), start(std::chrono::steady_clock::now()) {
+
+        // The shared pool is created lazily; do it here so the worker and the
+        // main thread cannot race to create it
+        noisePool();
+        worker = std::thread([this]() { run(); });
+    }
+
+    // Waits for the level being built; the ones after it are skipped
+    ~ProgressiveHeightmap() {
+        cancelled = true;
+        worker.join();
+    }
+
+    ProgressiveHeightmap(const ProgressiveHeightmap&) = delete;
+    ProgressiveHeightmap &operator=(const ProgressiveHeightmap&) = delete;
+
+    // The newest finished level not taken yet, or nullptr. A level that was
+    // never taken is dropped when a finer one arrives.
+    std::unique_ptr<HeightmapLevel> take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(ready);
+    }
+
+    // Every level has been delivered (the final one may not be taken yet)
+    bool finished() const { return done; }
+
+private:
+
+    void run() {
+        QuantizedHeightmap heights;
+        bool cached = !cacheDirectory.empty() &&
+                      loadCachedHeightmap(preset, seed, cacheDirectory, format, erosion, heights);
+
+        for (size_t l = 0; !cached && l < previewSizes.size() && !cancelled; ++l) {
+            const int size = previewSizes[l];
+            std::unique_ptr<HeightmapLevel> level(new HeightmapLevel());
+            float *noise_data = presetPreview2D(preset, seed, size);
+            level->heights = quantizeHeightmap(noise_data, size, size, format);
+            delete[] noise_data;
+
+            std::vector<float> samples = level->heights.decode();
+            level->normals = sobelNormalMap(samples.data(), size, size);
+            level->pyramid = std::unique_ptr<HeightPyramid>(
+                new HeightPyramid(samples.data(), size, size, -2.5f, -2.5f, 5.0f / size));
+            level->lod = buildTerrainLod(*level->pyramid, lodSettings, noisePool());
+            deliver(std::move(level));
+        }
+        if (cancelled) return;
+
+        std::unique_ptr<HeightmapLevel> level(new HeightmapLevel());
+        if (cached) {
+            level->heights = std::move(heights);
+        } else if (cacheDirectory.empty()) {
+            level->heights = presetHeightmap(preset, seed, format, erosion);
+        } else {
+            level->heights = generateCachedHeightmap(preset, seed, cacheDirectory, format, erosion);
+        }
+
+        const int width = level->heights.width, height = level->heights.height;
+        std::vector<float> samples = level->heights.decode();
+        level->normals = terrainNormalMap(preset, preset.params, seed, 512, erosion.enabled(),
+                                          samples.data(), width, height);
+        level->pyramid = std::unique_ptr<HeightPyramid>(new HeightPyramid(samples.data(), width, height));
+        level->lod = buildTerrainLod(*level->pyramid, lodSettings, noisePool());
+        level->final = true;
+        deliver(std::move(level));
+        done = true;
+    }
+
+    void deliver(std::unique_ptr<HeightmapLevel> level) {
+        level->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(mutex);
+        ready = std::move(level);
+    }
+
+    const FractalPreset preset;
+    const uint64_t seed;
+    const HeightmapFormat format;
+    const ErosionParams erosion;
+    const std::string cacheDirectory;
+    const TerrainLodSettings lodSettings;
+    const std::vector<int> previewSizes;
+    const std::chrono::steady_clock::time_point start;
+
+    std::mutex mutex;
+    std::unique_ptr<HeightmapLevel> ready;
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> done{false};
+    std::thread worker;
+};
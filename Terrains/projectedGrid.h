@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <OpenGP/GL/Application.h>
+#include "OpenGP/GL/Eigen.h"
+#include "grid.h"
+
+// Projected grid (Johanson, "Real-time water rendering: introducing the
+// projected grid concept"): the water is a fixed grid of columns x rows
+// vertices in screen space, and the vertex shader moves every vertex to
+// where its view ray meets the water plane (GridVertexFormat::Projected in
+// grid_vertex.glsl). Vertices are evenly spread on screen, so they are
+// dense near the camera and sparse in the distance, and their count does
+// not depend on the world's size. The plane has no edges; it reaches
+// maxDistance from the camera in every direction.
+//
+// The grid only spans the screen rows where the plane can be seen: between
+// the bottom (or top) of the screen and the horizon.
+class ProjectedGrid {
+public:
+
+    ProjectedGrid(const int columns, const int rows, const unsigned int restart)
+        : columns(columns), rows(rows), restart(restart) {
+        patch = patchIndexMesh(columns, rows, restart);
+    }
+
+    ProjectedGrid(const ProjectedGrid&) = delete;
+    ProjectedGrid &operator=(const ProjectedGrid&) = delete;
+
+    // Draws the plane z = level (model space) for the clip matrix P * V * M
+    // with a shader built for the projected format. Nothing if no part of
+    // the plane is on screen.
+    void draw(Shader &shader, const Mat4x4 &clip, const float level, const float maxDistance) {
+        const Mat4x4 inverse = clip.inverse();
+        float lo, hi;
+        drawn = false;
+        if (!visibleRows(inverse, level, lo, hi)) return;
+
+        shader.set_uniform("projector", inverse);
+        shader.set_uniform("projectorRows", Vec3(lo, hi, maxDistance));
+        shader.set_uniform("projectedColumns", columns);
+        shader.set_uniform("projectedRows", rows);
+        shader.set_uniform("projectedLevel", level);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(restart);
+        patch->draw();
+        drawn = true;
+    }
+
+    size_t vertexCount() const { return (size_t) columns * rows; }
+    bool drawnLastFrame() const { return drawn; }
+
+private:
+
+    // Whether the ray through NDC (x, y) reaches the plane in front of the camera
+    static bool meetsPlane(const Mat4x4 &inverse, const float level, const float x, const float y) {
+        Vec4 nearPoint = inverse * Vec4(x, y, -1.0f, 1.0f);
+        Vec4 farPoint = inverse * Vec4(x, y, 1.0f, 1.0f);
+        float from = nearPoint[2] / nearPoint[3], to = farPoint[2] / farPoint[3];
+        if (to == from) return false;
+        return (level - from) / (to - from) >= 0.0f;
+    }
+
+    // NDC heights [lo, hi] where the plane shows. The horizon is a straight
+    // line, so the screen's left and right edges bound it; each edge is
+    // scanned and its crossing refined, ending just past the horizon so the
+    // last row is pulled in to maxDistance.
+    static bool visibleRows(const Mat4x4 &inverse, const float level, float &lo, float &hi) {
+        const int samples = 64;
+        lo = 1.0f;
+        hi = -1.0f;
+        for (int side = 0; side < 2; ++side) {
+            const float x = side == 0 ? -1.0f : 1.0f;
+            for (int s = 0; s <= samples; ++s) {
+                float y = -1.0f + 2.0f * s / samples;
+                if (!meetsPlane(inverse, level, x, y)) continue;
+                lo = std::min(lo, s > 0 ? crossing(inverse, level, x, y - 2.0f / samples, y) : -1.0f);
+                hi = std::max(hi, s < samples ? crossing(inverse, level, x, y + 2.0f / samples, y) : 1.0f);
+            }
+        }
+        return lo <= hi;
+    }
+
+    // Between a y whose ray misses the plane and one whose ray meets it: a
+    // point within 1/4096 of the horizon, on the missing side (or the
+    // meeting y if the rays there both meet)
+    static float crossing(const Mat4x4 &inverse, const float level, const float x, float miss, float meet) {
+        if (meetsPlane(inverse, level, x, miss)) return meet;
+        while (std::abs(miss - meet) > 1.0f / 4096) {
+            float mid = 0.5f * (miss + meet);
+            (meetsPlane(inverse, level, x, mid) ? meet : miss) = mid;
+        }
+        return miss;
+    }
+
+    const int columns, rows;
+    const unsigned int restart;
+    std::unique_ptr<GPUMesh> patch;
+    bool drawn = false;
+};
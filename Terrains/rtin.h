@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <OpenGP/GL/Application.h>
+#include "grid.h"
+#include "heightPyramid.h"
+#include "parallel.h"
+
+// Right-triangulated irregular network (Evans, Kirkpatrick and Townsend,
+// "Right-Triangulated Irregular Networks") of the 5x5 patch: the map is
+// split by repeated bisection of right triangles at their hypotenuse, and a
+// triangle is only split where dropping its hypotenuse midpoint would move
+// the surface by more than the allowed vertical error. Flat ground ends up
+// with a few large triangles and the peaks with the full resolution.
+//
+// The grid has size x size cells, size a power of two at least the map's
+// cells (samples past the edge repeat it). Vertex (i, j) is heightmap sample
+// (i, j) as in HeightPyramid, stored at [i + j * (size + 1)].
+//
+// errors holds, for every vertex, the largest vertical error of the
+// triangles it splits, taken over everything below them too, so that a
+// triangle split for its own error also splits its neighbour across the
+// hypotenuse: the mesh has no cracks for any error bound.
+
+// A triangulation: 16-bit sample pairs (i, j) for the terrain shader's
+// compact grid format and a triangle list
+struct RTINMesh {
+    std::vector<GridIndex16> vertices;
+    std::vector<unsigned int> triangles;
+
+    size_t triangleCount() const { return triangles.size() / 3; }
+};
+
+class RTINTerrain {
+public:
+
+    // The error pass: level by level from the smallest triangles up, every
+    // level's vertices in parallel rows (they only read the level below).
+    // This and triangulate run on pool.
+    RTINTerrain(const HeightPyramid &terrain, WorkerPool &pool)
+        : width(terrain.width), height(terrain.height), size(1), pool(pool) {
+        while (size < std::max(width - 1, height - 1)) size *= 2;
+        const int n = size + 1;
+        const float *heights = terrain.worldHeights();
+        samples.resize((size_t) n * n);
+        errors.assign((size_t) n * n, 0.0f);
+        pool.parallelFor(n, [&](int rowBegin, int rowEnd) {
+            for (int j = rowBegin; j < rowEnd; ++j) {
+                const float *row = heights + (size_t) std::min(j, height - 1) * width;
+                for (int i = 0; i < n; ++i) {
+                    samples[i + (size_t) j * n] = row[std::min(i, width - 1)];
+                }
+            }
+        }, 64);
+
+        for (int s = 2; s <= size; s *= 2) {
+            const int half = s / 2, quarter = s / 4;
+
+            // Midpoints of the sides of s x s squares: rows j = 0, half, s, ...
+            pool.parallelFor(size / half + 1, [&](int rowBegin, int rowEnd) {
+                for (int r = rowBegin; r < rowEnd; ++r) {
+                    const int j = r * half;
+                    const bool alongI = j % s == 0;
+                    for (int i = alongI ? half : 0; i <= size; i += s) {
+                        float e = alongI ? ownError(i, j, i - half, j, i + half, j)
+                                         : ownError(i, j, i, j - half, i, j + half);
+
+                        // The centres of the squares of the level below on each side
+                        if (quarter > 0) {
+                            for (int c = 0; c < 4; ++c) {
+                                int ci = i + (c & 1 ? quarter : -quarter), cj = j + (c & 2 ? quarter : -quarter);
+                                if (ci >= 0 && ci <= size && cj >= 0 && cj <= size) e = std::max(e, error(ci, cj));
+                            }
+                        }
+                        error(i, j) = e;
+                    }
+                }
+            }, 16);
+
+            // Centres of the s x s squares, split along the diagonal that
+            // alternates with the square's parity
+            pool.parallelFor(size / s, [&](int rowBegin, int rowEnd) {
+                for (int r = rowBegin; r < rowEnd; ++r) {
+                    const int j = half + r * s;
+                    for (int q = 0; q < size / s; ++q) {
+                        const int i = half + q * s;
+                        float e = (q + r) % 2 == 0 ? ownError(i, j, i - half, j - half, i + half, j + half)
+                                                   : ownError(i, j, i + half, j - half, i - half, j + half);
+                        e = std::max(std::max(e, error(i - half, j)), error(i + half, j));
+                        e = std::max(std::max(e, error(i, j - half)), error(i, j + half));
+                        error(i, j) = e;
+                    }
+                }
+            }, 16);
+        }
+    }
+
+    RTINTerrain(const RTINTerrain&) = delete;
+    RTINTerrain &operator=(const RTINTerrain&) = delete;
+
+    // The triangulation within maxError (world units). The map is cut into
+    // tiles of tileCells x tileCells cells (a power of two) triangulated in
+    // parallel from both halves of the tile down; vertices are shared within
+    // a tile and repeated on tile edges.
+    void triangulate(const float maxError, RTINMesh &mesh, const int tileCells = 256) const {
+        const int cells = std::min(tileCells, size);
+        const int tiles = size / cells;
+
+        std::vector<RTINMesh> parts(tiles * tiles);
+        pool.parallelFor(tiles * tiles, [&](int begin, int end) {
+            std::vector<int> slots((size_t)(cells + 1) * (cells + 1));
+            for (int t = begin; t < end; ++t) {
+                triangulateTile(t % tiles, t / tiles, cells, maxError, slots, parts[t]);
+            }
+        }, 1);
+
+        // Tile parts at their offsets in the one mesh
+        std::vector<size_t> vertexOffset(parts.size() + 1, 0), triangleOffset(parts.size() + 1, 0);
+        for (size_t t = 0; t < parts.size(); ++t) {
+            vertexOffset[t + 1] = vertexOffset[t] + parts[t].vertices.size();
+            triangleOffset[t + 1] = triangleOffset[t] + parts[t].triangles.size();
+        }
+        mesh.vertices.resize(vertexOffset.back());
+        mesh.triangles.resize(triangleOffset.back());
+        pool.parallelFor((int) parts.size(), [&](int begin, int end) {
+            for (int t = begin; t < end; ++t) {
+                std::copy(parts[t].vertices.begin(), parts[t].vertices.end(), mesh.vertices.begin() + vertexOffset[t]);
+                unsigned int *out = mesh.triangles.data() + triangleOffset[t];
+                for (size_t k = 0; k < parts[t].triangles.size(); ++k) {
+                    out[k] = parts[t].triangles[k] + (unsigned int) vertexOffset[t];
+                }
+            }
+        }, 4);
+    }
+
+    RTINMesh triangulate(const float maxError, const int tileCells = 256) const {
+        RTINMesh mesh;
+        triangulate(maxError, mesh, tileCells);
+        return mesh;
+    }
+
+    int threads() const { return pool.size(); }
+
+    // Triangles of the uniform grid over the map's samples
+    size_t fullTriangleCount() const { return 2 * (size_t)(width - 1) * (height - 1); }
+
+    // Largest vertical error of the triangles vertex (i, j) splits
+    float vertexError(const int i, const int j) const { return errors[i + (size_t) j * (size + 1)]; }
+
+    const int width, height;    // heightmap samples
+    int size;                   // cells on a side of the triangulated grid
+
+private:
+
+    float sample(const int i, const int j) const { return samples[i + (size_t) j * (size + 1)]; }
+    float &error(const int i, const int j) { return errors[i + (size_t) j * (size + 1)]; }
+
+    // Height of m against the hypotenuse a-b it would split
+    float ownError(const int mi, const int mj, const int ai, const int aj, const int bi, const int bj) const {
+        return std::abs(sample(mi, mj) - 0.5f * (sample(ai, aj) + sample(bi, bj)));
+    }
+
+    // Tile (ti, tj) starts as the two triangles either side of its square's
+    // diagonal, which alternates like the error pass's
+    void triangulateTile(const int ti, const int tj, const int cells, const float maxError,
+                         std::vector<int> &slots, RTINMesh &part) const {
+        std::fill(slots.begin(), slots.end(), -1);
+        part.vertices.clear();
+        part.triangles.clear();
+        const int i0 = ti * cells, j0 = tj * cells, i1 = i0 + cells, j1 = j0 + cells;
+        Tile tile{ i0, j0, cells, maxError, slots, part };
+        if ((ti + tj) % 2 == 0) {
+            split(tile, i0, j0, i1, j1, i1, j0);
+            split(tile, i1, j1, i0, j0, i0, j1);
+        } else {
+            split(tile, i1, j0, i0, j1, i0, j0);
+            split(tile, i0, j1, i1, j0, i1, j1);
+        }
+    }
+
+    struct Tile {
+        int i0, j0, cells;
+        float maxError;
+        std::vector<int> &slots;
+        RTINMesh &part;
+    };
+
+    // Triangle with hypotenuse a-b and right angle at c
+    void split(Tile &tile, const int ai, const int aj, const int bi, const int bj, const int ci, const int cj) const {
+        const int mi = ai + bi, mj = aj + bj;
+        if (mi % 2 == 0 && mj % 2 == 0 && vertexError(mi / 2, mj / 2) > tile.maxError) {
+            split(tile, ci, cj, ai, aj, mi / 2, mj / 2);
+            split(tile, bi, bj, ci, cj, mi / 2, mj / 2);
+            return;
+        }
+
+        // Counter-clockwise seen from above: world x follows j, y follows i
+        unsigned int a = vertex(tile, ai, aj), b = vertex(tile, bi, bj), c = vertex(tile, ci, cj);
+        if ((bj - aj) * (ci - ai) - (bi - ai) * (cj - aj) < 0) std::swap(b, c);
+        tile.part.triangles.push_back(a);
+        tile.part.triangles.push_back(b);
+        tile.part.triangles.push_back(c);
+    }
+
+    unsigned int vertex(Tile &tile, const int i, const int j) const {
+        int &slot = tile.slots[(i - tile.i0) + (size_t)(j - tile.j0) * (tile.cells + 1)];
+        if (slot < 0) {
+            slot = (int) tile.part.vertices.size();
+            tile.part.vertices.push_back(GridIndex16((unsigned short) std::min(i, width - 1),
+                                                     (unsigned short) std::min(j, height - 1)));
+        }
+        return (unsigned int) slot;
+    }
+
+    WorkerPool &pool;
+    std::vector<float> samples;     // world heights, repeated past the map's edge
+    std::vector<float> errors;
+};
+
+// A triangulation as a mesh for the terrain shader built with the compact
+// grid format, drawn with gridN the heightmap width
+inline std::unique_ptr<GPUMesh> rtinGPUMesh(const RTINMesh &mesh) {
+    std::unique_ptr<GPUMesh> gpu(new GPUMesh());
+    gpu->set_vbo<GridIndex16>("vgrid", mesh.vertices);
+    gpu->set_triangles(mesh.triangles);
+    gpu->set_mode(GL_TRIANGLES);
+    return gpu;
+}
+
+// Triangles, vertices and time at a range of error bounds, against the
+// uniform grid over every sample and the drawn gridN x gridN grid
+inline void reportRTINReduction(const RTINTerrain &terrain, const int gridN) {
+    const float bounds[] = { 0.0f, 0.0005f, 0.001f, 0.002f, 0.005f, 0.01f, 0.02f };
+    const size_t full = terrain.fullTriangleCount(), drawn = 2 * (size_t)(gridN - 1) * (gridN - 1);
+    std::cout << "RTIN over " << terrain.width << "x" << terrain.height << " samples (" << full
+              << " triangles uniform), " << terrain.threads() << " threads" << std::endl;
+    RTINMesh mesh;
+    for (size_t k = 0; k < sizeof(bounds) / sizeof(bounds[0]); ++k) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        terrain.triangulate(bounds[k], mesh);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  max error " << bounds[k] << ": " << mesh.triangleCount() << " triangles ("
+                  << 100.0 * mesh.triangleCount() / full << "% of the full grid, "
+                  << 100.0 * mesh.triangleCount() / drawn << "% of the " << gridN << "^2 grid), "
+                  << mesh.vertices.size() << " vertices, " << ms << " ms" << std::endl;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include "cdlod.h"
+#include "clipmap.h"
+#include "heightPyramid.h"
+#include "parallel.h"
+#include "rtin.h"
+#include "waterTiles.h"
+
+// What the terrain modes derive from the heights: the clipmap levels, the
+// CDLOD quadtree, the RTIN errors and mesh, and the water tiles' coverage.
+// None of it needs GL, so it can be built on any thread (ProgressiveHeightmap
+// builds it with each level); the render thread then only uploads meshes and
+// swaps pointers.
+
+struct TerrainLodSettings {
+    bool clipmap = false;
+    bool cdlod = false;
+    CDLODSettings cdlodSettings;
+    bool waterCoverage = false;     // tiles for WaterPatches
+    bool rtin = false;              // the mesh as well as the errors
+    bool rtinReport = false;        // errors and the reduction table only
+    float rtinMaxError = 0.002f;
+    int gridN = 0;                  // the shared grid (waterTiles.h)
+    float gridSize = 0.0f;
+    int waterTileQuads = 32;
+    unsigned int restart = 0;       // primitive restart index of the clipmap patches
+};
+
+// Everything refers to the HeightPyramid it was built from, which must outlive it
+struct TerrainLod {
+    std::unique_ptr<GeometryClipmap> clipmap;
+    std::unique_ptr<CDLODQuadtree> quadtree;
+    std::unique_ptr<WaterCoverage> water;
+    std::unique_ptr<RTINTerrain> rtin;
+    std::unique_ptr<RTINMesh> rtinMesh;
+};
+
+// Parallel work runs on pool: noisePool on a background generator, which has
+// it to itself between levels, renderPool on the render thread.
+inline TerrainLod buildTerrainLod(const HeightPyramid &terrain, const TerrainLodSettings &settings, WorkerPool &pool) {
+    TerrainLod lod;
+    if (settings.clipmap) {
+        lod.clipmap = std::unique_ptr<GeometryClipmap>(new GeometryClipmap(terrain, settings.restart, pool));
+    }
+    if (settings.cdlod) {
+        lod.quadtree = std::unique_ptr<CDLODQuadtree>(new CDLODQuadtree(terrain, settings.cdlodSettings));
+    }
+    if (settings.waterCoverage) {
+        lod.water = std::unique_ptr<WaterCoverage>(new WaterCoverage(
+            waterCoverage(terrain, settings.gridN, settings.gridSize, pool, settings.waterTileQuads)));
+    }
+    if (settings.rtin || settings.rtinReport) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        lod.rtin = std::unique_ptr<RTINTerrain>(new RTINTerrain(terrain, pool));
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "RTIN errors of " << lod.rtin->width << "^2 heights: " << ms << " ms" << std::endl;
+        if (settings.rtinReport) {
+            reportRTINReduction(*lod.rtin, settings.gridN);
+        }
+    }
+    if (settings.rtin) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        lod.rtinMesh = std::unique_ptr<RTINMesh>(new RTINMesh());
+        lod.rtin->triangulate(settings.rtinMaxError, *lod.rtinMesh);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "RTIN mesh within " << settings.rtinMaxError << ": " << lod.rtinMesh->triangleCount()
+                  << " triangles, " << lod.rtinMesh->vertices.size() << " vertices (" << ms << " ms)" << std::endl;
+    }
+    return lod;
+}
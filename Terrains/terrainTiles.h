@@ -0,0 +1,498 @@
+#pragma once
+
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "fractalPresets.h"
+#include "normalMap.h"
+
+// Infinite terrain: world-space noise, tiles keyed by (x, y, lod) generated
+// on background threads, and bounded LRU caches of CPU and GPU tiles.
+//
+// World units follow the fixed 5x5 patch: its 2048^2 heightmap covers
+// [-2.5, 2.5]^2, texture columns follow world y and rows follow world x.
+
+// Map pixels per world unit (2048 texels over 5 units)
+const double worldPixelsPerUnit = 2048.0 / 5.0;
+
+// Samples per tile edge; lod 0 tiles have the texel spacing of the fixed map
+const int tileSamples = 129;
+
+// Edge length of a lod 0 tile in world units
+const double tileSize0 = (tileSamples - 1) / worldPixelsPerUnit;
+
+// Coarsest level; a lod 7 tile is 40 units across, beyond the far plane
+const int tileMaxLod = 7;
+
+inline double tileSize(int lod) {
+    return tileSize0 * (1 << lod);
+}
+
+// Spacing of a tile's samples in uv units (the 5x5 patch is one uv unit)
+inline float tileTexel(int lod) {
+    return (float)(tileSize(lod) / (tileSamples - 1) / 5.0);
+}
+
+struct TileKey {
+    int x, y, lod;
+
+    bool operator==(const TileKey &other) const {
+        return x == other.x && y == other.y && lod == other.lod;
+    }
+};
+
+struct TileKeyHash {
+    size_t operator()(const TileKey &key) const {
+        return (size_t) mix64(((uint64_t)(uint32_t) key.x << 32 | (uint32_t) key.y) ^ ((uint64_t) key.lod << 58));
+    }
+};
+
+// Least-recently-used cache with a fixed number of entries
+template <typename Key, typename Value, typename Hash>
+class LruCache {
+public:
+
+    explicit LruCache(size_t capacity) : capacity(capacity) {}
+
+    // Entry for key, marked as most recently used; nullptr on a miss
+    Value *get(const Key &key) {
+        typename Map::iterator it = entries.find(key);
+        if (it == entries.end()) {
+            ++misses;
+            return nullptr;
+        }
+        ++hits;
+        order.splice(order.begin(), order, it->second.second);
+        return &it->second.first;
+    }
+
+    // Entry for key without counting the lookup or touching the order
+    Value *peek(const Key &key) {
+        typename Map::iterator it = entries.find(key);
+        return it == entries.end() ? nullptr : &it->second.first;
+    }
+
+    bool contains(const Key &key) const {
+        return entries.find(key) != entries.end();
+    }
+
+    void put(const Key &key, Value value) {
+        typename Map::iterator it = entries.find(key);
+        if (it != entries.end()) {
+            it->second.first = std::move(value);
+            order.splice(order.begin(), order, it->second.second);
+            return;
+        }
+        while (!order.empty() && entries.size() >= capacity) {
+            entries.erase(order.back());
+            order.pop_back();
+            ++evictions;
+        }
+        order.push_front(key);
+        entries.insert(std::make_pair(key, std::make_pair(std::move(value), order.begin())));
+    }
+
+    size_t size() const { return entries.size(); }
+
+    size_t capacity;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+
+private:
+    typedef std::unordered_map<Key, std::pair<Value, typename std::list<Key>::iterator>, Hash> Map;
+    std::list<Key> order;
+    Map entries;
+};
+
+// Non-periodic version of a preset's fractal, evaluated at any map pixel
+// coordinate. The lattice gradients are the ones perlin2D hashes, so inside
+// [0, 2048)^2 the base octave matches the fixed map; higher octaves do not
+// wrap around the map like fBm2D does.
+class WorldNoise {
+public:
+
+    WorldNoise(const FractalPreset &preset, const uint64_t seed, const int period=512)
+        : params(preset.params), hybrid(preset.hybrid), seed(seed), period(period),
+          curve(preset.cubicFade ? cubicFade : fade), exponents(fractalExponents(preset.params)) {}
+
+    // Remembers the last lattice cell of each octave; samples taken along a
+    // row mostly stay in the same cell, so gradients are rarely re-hashed
+    struct Sampler {
+        struct Cell {
+            double cx, cy;
+            float g[8];
+        };
+        std::vector<Cell> cells;
+    };
+
+    Sampler sampler() const {
+        Sampler s;
+        Sampler::Cell empty = { NAN, NAN, { 0 } };
+        s.cells.assign(params.octaves, empty);
+        return s;
+    }
+
+    // Height at map pixel (col, row), as stored in the heightmap textures
+    float height(double col, double row, Sampler &s) const {
+        if (hybrid) {
+            float perlin = 1 - std::abs(sample(col, row, s.cells[0]));
+            float weight = perlin;
+            for (int k = 1; k < params.octaves; k++) {
+                if (weight > 1.0) {
+                    weight = 1.0;
+                }
+                float signal = (perlin + params.offset) * exponents[k];
+                perlin += weight * signal;
+                weight *= signal;
+            }
+            return perlin;
+        }
+
+        float noise = 0.0f;
+        double scale = 1.0;
+        for (int k = 0; k < params.octaves; ++k) {
+            float perlin = sample(col * scale, row * scale, s.cells[k]);
+            noise += (perlin + params.offset) * exponents[k];
+            scale *= params.lacunarity;
+        }
+        return noise;
+    }
+
+private:
+
+    // Pixel coordinate of a lattice point, wrapped like the int keys of perlin2D
+    int latticeCoordinate(double cell) const {
+        double wrapped = std::fmod(cell, 4294967296.0);
+        return (int)(uint32_t)((int64_t) wrapped * period);
+    }
+
+    float sample(double px, double py, Sampler::Cell &cell) const {
+        double x = px / period;
+        double y = py / period;
+        double cx = std::floor(x);
+        double cy = std::floor(y);
+
+        if (cx != cell.cx || cy != cell.cy) {
+            int left = latticeCoordinate(cx);
+            int right = latticeCoordinate(cx + 1);
+            int top = latticeCoordinate(cy);
+            int bottom = latticeCoordinate(cy + 1);
+            Vec2 g[4] = { latticeGradient(seed, left, top), latticeGradient(seed, right, top),
+                          latticeGradient(seed, left, bottom), latticeGradient(seed, right, bottom) };
+            for (int k = 0; k < 4; ++k) {
+                cell.g[2 * k] = g[k][0];
+                cell.g[2 * k + 1] = g[k][1];
+            }
+            cell.cx = cx;
+            cell.cy = cy;
+        }
+
+        float dx = (float)(x - cx);
+        float dy = (float)(y - cy);
+        const float *g = cell.g;
+
+        float s = g[0] * dx + g[1] * (-dy);
+        float t = g[2] * (dx - 1) + g[3] * (-dy);
+        float u = g[4] * dx + g[5] * (1 - dy);
+        float v = g[6] * (dx - 1) + g[7] * (1 - dy);
+
+        float fx = curve(dx);
+        float st = lerp(s, t, fx);
+        float uv = lerp(u, v, fx);
+        return lerp(st, uv, curve(dy));
+    }
+
+    FractalParams params;
+    bool hybrid;
+    uint64_t seed;
+    int period;
+    float (*curve)(float);
+    std::vector<float> exponents;
+};
+
+// Heights of one tile, laid out like the fixed map: column s follows world y,
+// row t follows world x, tileSamples^2 texels including both edges
+inline std::vector<float> generateTile(const WorldNoise &noise, const TileKey &key) {
+    std::vector<float> heights(tileSamples * tileSamples);
+    WorldNoise::Sampler sampler = noise.sampler();
+
+    // Tile corners land on whole map pixels, 2^lod pixels apart
+    double spacing = (double)(1 << key.lod);
+    double col0 = key.y * (tileSamples - 1) * spacing + 1024.0;
+    double row0 = key.x * (tileSamples - 1) * spacing + 1024.0;
+
+    for (int t = 0; t < tileSamples; ++t) {
+        for (int s = 0; s < tileSamples; ++s) {
+            heights[s + t * tileSamples] = noise.height(col0 + s * spacing, row0 + t * spacing, sampler);
+        }
+    }
+    return heights;
+}
+
+// What a worker produces for a tile: heights and their Sobel normals. The
+// Sobel pass stays on the worker's thread: the tile workers are already the
+// parallelism, and noisePool runs one job at a time.
+struct TileData {
+    std::vector<float> heights;
+    std::vector<int16_t> normals;
+};
+
+inline TileData generateTileData(const WorldNoise &noise, const TileKey &key) {
+    TileData tile;
+    tile.heights = generateTile(noise, key);
+    tile.normals.resize(2 * tile.heights.size());
+    sobelNormals(tile.heights.data(), tileSamples, tileSamples, tileTexel(key.lod), tile.normals.data());
+    return tile;
+}
+
+// A tile resident on the GPU
+struct TileTextures {
+    std::unique_ptr<R32FTexture> heights;
+    std::unique_ptr<RG16SnormTexture> normals;
+};
+
+struct TileStats {
+    size_t cpuHits, cpuMisses, cpuEvictions;
+    size_t gpuHits, gpuMisses, gpuEvictions;
+    size_t generated, uploaded, prefetchRequests;
+};
+
+// Generates tiles around the camera on background threads and keeps the
+// most recently used ones in CPU memory and in GPU textures
+class TileStreamer {
+public:
+
+    TileStreamer(const FractalPreset &preset, const uint64_t seed, int threads=0,
+                 size_t cpuCapacity=2048, size_t gpuCapacity=512)
+        : noise(preset, seed), cpuTiles(cpuCapacity), gpuTiles(gpuCapacity) {
+
+        if (threads <= 0) {
+            threads = std::max(1, (int) std::thread::hardware_concurrency() - 1);
+        }
+        for (int t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([this]() { workerLoop(); }));
+        }
+    }
+
+    ~TileStreamer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+    }
+
+    // Distance, in tile sizes of its own level, below which a tile is split
+    float splitDistance = 1.0f;
+
+    // Coarsest tiles are kept within this distance (the far plane)
+    float viewDistance = 60.0f;
+
+    // How far ahead along the view direction tiles are prefetched (world units)
+    float prefetchDistance = 2.0f;
+
+    // Tiles moved from the CPU cache to textures per frame
+    int uploadsPerFrame = 16;
+
+    // Picks the tiles to draw this frame, uploads finished tiles and queues
+    // generation of the missing ones, visible tiles before prefetched ones
+    void update(const Vec3 &eye, const Vec3 &front) {
+        drawList.clear();
+        std::vector<TileKey> wanted;
+        select(eye, true, wanted);
+
+        // Tiles the camera will need if it keeps moving forward
+        Vec3 ahead = eye + prefetchDistance * Vec3(front[0], front[1], 0.0f);
+        std::vector<TileKey> prefetch;
+        select(ahead, false, prefetch);
+
+        int uploads = 0;
+        std::deque<TileKey> requests;
+        std::unordered_set<TileKey, TileKeyHash> queued;
+        for (size_t n = 0; n < wanted.size() + prefetch.size(); ++n) {
+            bool isPrefetch = n >= wanted.size();
+            const TileKey &key = isPrefetch ? prefetch[n - wanted.size()] : wanted[n];
+            if (gpuTiles.contains(key) || !queued.insert(key).second) continue;
+
+            std::shared_ptr<TileData> data;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::shared_ptr<TileData> *cached = cpuTiles.get(key);
+                if (cached) data = *cached;
+            }
+
+            // Prefetched tiles only warm the CPU cache
+            if (data) {
+                if (!isPrefetch && uploads < uploadsPerFrame) {
+                    upload(key, *data);
+                    ++uploads;
+                }
+            } else {
+                requests.push_back(key);
+                if (isPrefetch) ++stats.prefetchRequests;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.swap(requests);
+        }
+        wake.notify_all();
+    }
+
+    // Tiles selected by the last update, all resident on the GPU
+    const std::vector<TileKey> &tiles() const {
+        return drawList;
+    }
+
+    const TileTextures *textures(const TileKey &key) {
+        return gpuTiles.peek(key);
+    }
+
+    TileStats statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        TileStats s = stats;
+        s.cpuHits = cpuTiles.hits;
+        s.cpuMisses = cpuTiles.misses;
+        s.cpuEvictions = cpuTiles.evictions;
+        s.gpuHits = gpuTiles.hits;
+        s.gpuMisses = gpuTiles.misses;
+        s.gpuEvictions = gpuTiles.evictions;
+        return s;
+    }
+
+    void printStatistics() {
+        TileStats s = statistics();
+        double cpuRate = s.cpuHits + s.cpuMisses ? (double) s.cpuHits / (s.cpuHits + s.cpuMisses) : 0.0;
+        double gpuRate = s.gpuHits + s.gpuMisses ? (double) s.gpuHits / (s.gpuHits + s.gpuMisses) : 0.0;
+        std::cout << "tiles: " << drawList.size() << " drawn, "
+                  << s.generated << " generated, " << s.uploaded << " uploaded, "
+                  << s.prefetchRequests << " prefetch requests" << std::endl
+                  << "  cpu cache " << cpuTiles.size() << "/" << cpuTiles.capacity
+                  << " hit rate " << cpuRate * 100.0 << "% evictions " << s.cpuEvictions << std::endl
+                  << "  gpu cache " << gpuTiles.size() << "/" << gpuTiles.capacity
+                  << " hit rate " << gpuRate * 100.0 << "% evictions " << s.gpuEvictions << std::endl;
+    }
+
+private:
+
+    // Distance from eye to the tile's box (heights lie within [0, 2])
+    static float distanceTo(const Vec3 &eye, const TileKey &key) {
+        double size = tileSize(key.lod);
+        double x0 = key.x * size, y0 = key.y * size;
+        double dx = std::max(std::max(x0 - eye[0], eye[0] - (x0 + size)), 0.0);
+        double dy = std::max(std::max(y0 - eye[1], eye[1] - (y0 + size)), 0.0);
+        double dz = std::max(std::max(0.0 - eye[2], eye[2] - 2.0), 0.0);
+        return (float) std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    bool shouldSplit(const Vec3 &eye, const TileKey &key) const {
+        return key.lod > 0 && distanceTo(eye, key) < splitDistance * tileSize(key.lod);
+    }
+
+    // Quadtree selection, coarse levels first. With resident set, a tile is
+    // only replaced by its children once all four are on the GPU, so the
+    // draw list never has holes or overlaps; the children are still wanted.
+    void select(const Vec3 &eye, bool resident, std::vector<TileKey> &wanted) {
+        double rootSize = tileSize(tileMaxLod);
+        double reach = viewDistance;
+        int x0 = (int) std::floor((eye[0] - reach) / rootSize);
+        int x1 = (int) std::floor((eye[0] + reach) / rootSize);
+        int y0 = (int) std::floor((eye[1] - reach) / rootSize);
+        int y1 = (int) std::floor((eye[1] + reach) / rootSize);
+
+        std::deque<TileKey> queue;
+        for (int x = x0; x <= x1; ++x) {
+            for (int y = y0; y <= y1; ++y) {
+                TileKey root = { x, y, tileMaxLod };
+                queue.push_back(root);
+            }
+        }
+
+        while (!queue.empty()) {
+            TileKey key = queue.front();
+            queue.pop_front();
+            wanted.push_back(key);
+
+            bool onGpu = resident && gpuTiles.get(key) != nullptr;
+            if (resident && !onGpu) continue;
+
+            bool split = shouldSplit(eye, key);
+            TileKey children[4];
+            bool childrenReady = split;
+            for (int c = 0; c < 4; ++c) {
+                TileKey child = { 2 * key.x + (c & 1), 2 * key.y + (c >> 1), key.lod - 1 };
+                children[c] = child;
+                if (split && resident && !gpuTiles.contains(child)) childrenReady = false;
+            }
+
+            if (split) {
+                for (int c = 0; c < 4; ++c) {
+                    if (childrenReady) queue.push_back(children[c]);
+                    else wanted.push_back(children[c]);
+                }
+            }
+            if (resident && !childrenReady) {
+                drawList.push_back(key);
+            }
+        }
+    }
+
+    void upload(const TileKey &key, const TileData &data) {
+        TileTextures tex;
+        tex.heights = std::unique_ptr<R32FTexture>(new R32FTexture());
+        tex.heights->upload_raw(tileSamples, tileSamples, data.heights.data());
+        tex.normals = std::unique_ptr<RG16SnormTexture>(uploadNormalTexture(tileSamples, tileSamples, data.normals.data()));
+        gpuTiles.put(key, std::move(tex));
+        ++stats.uploaded;
+    }
+
+    void workerLoop() {
+        for (;;) {
+            TileKey key;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !pending.empty(); });
+                if (stopping) return;
+                key = pending.front();
+                pending.pop_front();
+                if (cpuTiles.contains(key) || !inFlight.insert(key).second) continue;
+            }
+
+            std::shared_ptr<TileData> data(new TileData(generateTileData(noise, key)));
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                cpuTiles.put(key, data);
+                inFlight.erase(key);
+                ++stats.generated;
+            }
+        }
+    }
+
+    WorldNoise noise;
+
+    // Guards pending, inFlight, cpuTiles and stats
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<TileKey> pending;
+    std::unordered_set<TileKey, TileKeyHash> inFlight;
+    LruCache<TileKey, std::shared_ptr<TileData>, TileKeyHash> cpuTiles;
+    TileStats stats = TileStats();
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    // Main thread only (owns the GL objects)
+    LruCache<TileKey, TileTextures, TileKeyHash> gpuTiles;
+    std::vector<TileKey> drawList;
+};
@@ -1,35 +1,40 @@
 R"(
 #version 330 core
 uniform sampler2D noiseTex;
+// Heights are stored quantised: h = texel * heightScale + heightOffset
+uniform float heightScale;
+uniform float heightOffset;
 
-in vec3 vposition;
-in vec2 vtexcoord;
+// Vertex position and uv come from gridPosition() and gridUV() (grid_vertex.glsl)
 
 uniform mat4 M;
 uniform mat4 V;
 uniform mat4 P;
+uniform float zOffset;      // height of this surface on the shared grid
 
 out vec2 uv;
+out vec2 heightUV;
 out vec3 fragPos;
 
 out float waterHeight;
 
 void main() {
 
-    uv = vtexcoord;
+    uv = gridUV();
+    heightUV = uv;
 
     // Earth scene
     float water = 0.53f;
 
     
     // TODO: Calculate height
-    float  h = (texture(noiseTex, uv).r + 1.0f);
+    float  h = (texture(noiseTex, uv).r * heightScale + heightOffset + 1.0f);
     h*=0.6;
     
     
 
     // TODO: Set fragment position
-    fragPos = vposition.xyz + vec3(0, 0, h);
+    fragPos = gridPosition() + vec3(0, 0, zOffset + h);
 
     // Set gl_Position
     gl_Position = P*V*M*vec4(fragPos, 1.0f);
@@ -0,0 +1,47 @@
+R"(
+#version 330 core
+uniform sampler2D noiseTex;
+
+// Tile grid in [0,1]^2; z is 1 on the skirt ring around the tile
+in vec3 vposition;
+// Texel of the tile heightmap (columns follow world y, rows world x)
+in vec2 vtexcoord;
+
+uniform mat4 M;
+uniform mat4 V;
+uniform mat4 P;
+
+// World x, y of the tile corner and its edge length
+uniform vec3 tile;
+uniform float skirtDepth;
+
+out vec2 uv;
+out vec2 heightUV;
+out vec3 fragPos;
+
+out float waterHeight;
+
+void main() {
+
+    heightUV = vtexcoord;
+
+    // Same uv as the 5x5 patch, continued past its edges
+    vec2 world = tile.xy + vposition.xy * tile.z;
+    uv = vec2(world.y + 2.5f, world.x + 2.5f) / 5.0f;
+
+    // Earth scene
+    float water = 0.53f;
+
+    float h = (texture(noiseTex, heightUV).r + 1.0f);
+    h *= 0.6;
+
+    // Skirts hide the cracks between tiles of different levels
+    h -= vposition.z * skirtDepth;
+
+    fragPos = vec3(world, h);
+
+    gl_Position = P*V*M*vec4(fragPos, 1.0f);
+
+    waterHeight = water;
+}
+)"
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <OpenGP/GL/Application.h>
+#include "parallel.h"
+
+// Index orders for the grid meshes and a model of the post-transform vertex
+// cache to compare them without a GPU. Rows is the original layout: one
+// strip per row pair, the full width of the grid, so by the time a strip
+// comes back to a vertex the cache has long dropped it and every vertex is
+// transformed twice. Tiled cuts the grid into bands narrow enough for a row
+// to stay cached until the next strip reuses it. Forsyth reorders the
+// triangle list greedily by the scores of "Linear-Speed Vertex Cache
+// Optimisation" (Forsyth, 2006), and works for any mesh.
+enum class GridIndexOrder { Rows, Tiled, Forsyth };
+
+inline const char *gridIndexOrderName(GridIndexOrder order) {
+    switch (order) {
+        case GridIndexOrder::Tiled: return "tiled";
+        case GridIndexOrder::Forsyth: return "forsyth";
+        default: return "rows";
+    }
+}
+
+inline bool parseGridIndexOrder(const std::string &name, GridIndexOrder &order) {
+    if (name == "rows") order = GridIndexOrder::Rows;
+    else if (name == "tiled") order = GridIndexOrder::Tiled;
+    else if (name == "forsyth") order = GridIndexOrder::Forsyth;
+    else return false;
+    return true;
+}
+
+// Rows and Tiled are strips joined by the restart index, Forsyth a list
+inline GLenum gridIndexMode(GridIndexOrder order) {
+    return order == GridIndexOrder::Forsyth ? GL_TRIANGLES : GL_TRIANGLE_STRIP;
+}
+
+// Cache size the orders are tuned for: vertices, FIFO replacement
+const int vertexCacheSize = 32;
+
+// Tiled bands are band quads wide. The first strip of a band loads both of
+// its rows, 2 (band + 1) vertices, and on a FIFO the first of them must
+// survive until the next strip; after that each strip loads one row.
+inline int tiledBandWidth(const int cacheSize = vertexCacheSize) {
+    return std::max(cacheSize / 2 - 1, 1);
+}
+
+inline size_t tiledPatchIndexCount(const int w, const int h, const int band) {
+    size_t count = 0;
+    for (int i0 = 0; i0 < w - 1; i0 += band) {
+        int quads = std::min(band, w - 1 - i0);
+        count += (size_t)(h - 1) * (2 * (size_t)(quads + 1) + 1);
+    }
+    return count;
+}
+
+// Strips of a w x h patch (vertex (j, i) at i + j * w) band by band: within
+// each band of `band` quads, one short strip per row pair, top to bottom
+inline void generateTiledPatchIndices(const int w, const int h, const int band, const unsigned int restart,
+                                      std::vector<unsigned int> &indices, WorkerPool *pool = nullptr) {
+    assert((size_t) w * h <= restart);
+    indices.resize(tiledPatchIndexCount(w, h, band));
+    const int bands = (w - 1 + band - 1) / band;
+
+    auto fill = [&](int bandBegin, int bandEnd) {
+        for (int b = bandBegin; b < bandEnd; ++b) {
+            int i0 = b * band, quads = std::min(band, w - 1 - i0);
+            unsigned int *out = indices.data() + tiledPatchIndexCount(i0 + 1, h, band);
+            for (int j = 0; j < h - 1; ++j) {
+                unsigned int row = (unsigned int) j * (unsigned int) w;
+                for (int i = i0; i <= i0 + quads; ++i) {
+                    *out++ = row + i;
+                    *out++ = row + w + i;
+                }
+                *out++ = restart;
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(bands, fill, 1);
+    } else {
+        fill(0, bands);
+    }
+}
+
+// Triangles of strips joined by restart, as GL assembles them (odd
+// triangles flipped to keep the winding); degenerate ones are dropped
+inline void stripTriangles(const std::vector<unsigned int> &strips, const unsigned int restart,
+                           std::vector<unsigned int> &triangles) {
+    triangles.clear();
+    size_t length = 0;
+    for (size_t k = 0; k < strips.size(); ++k) {
+        if (strips[k] == restart) {
+            length = 0;
+            continue;
+        }
+        if (++length < 3) continue;
+        unsigned int a = strips[k - 2], b = strips[k - 1], c = strips[k];
+        if (a == b || b == c || a == c) continue;
+        if (length % 2 == 1) {
+            triangles.push_back(a);
+            triangles.push_back(b);
+        } else {
+            triangles.push_back(b);
+            triangles.push_back(a);
+        }
+        triangles.push_back(c);
+    }
+}
+
+// Forsyth's greedy ordering of a triangle list over vertexCount vertices:
+// repeatedly emit the triangle whose vertices score best, where a vertex
+// scores for being recently used (in a modelled LRU cache of cacheSize) and
+// for having few triangles left, so that it can be retired
+inline void optimizeVertexCache(const std::vector<unsigned int> &triangles, const size_t vertexCount,
+                                std::vector<unsigned int> &out, const int cacheSize = vertexCacheSize) {
+    const size_t count = triangles.size() / 3;
+    out.resize(triangles.size());
+    if (count == 0) return;
+
+    // Score tables: by cache position, and by triangles left (capped)
+    const int maxValence = 32;
+    std::vector<float> cacheScore(cacheSize + 3), valenceScore(maxValence + 1);
+    for (int p = 0; p < cacheSize + 3; ++p) {
+        if (p < 3) cacheScore[p] = 0.75f;
+        else if (p < cacheSize) cacheScore[p] = std::pow(1.0f - (p - 3) / (float)(cacheSize - 3), 1.5f);
+        else cacheScore[p] = 0.0f;
+    }
+    for (int v = 1; v <= maxValence; ++v) {
+        valenceScore[v] = 2.0f / std::sqrt((float) v);
+    }
+
+    // Triangles of each vertex; the first remaining[v] are not emitted yet
+    std::vector<unsigned int> offset(vertexCount + 1, 0), remaining(vertexCount, 0);
+    for (size_t k = 0; k < triangles.size(); ++k) remaining[triangles[k]]++;
+    for (size_t v = 0; v < vertexCount; ++v) offset[v + 1] = offset[v] + remaining[v];
+    std::vector<unsigned int> vertexTriangles(triangles.size());
+    {
+        std::vector<unsigned int> fill(offset.begin(), offset.end() - 1);
+        for (size_t t = 0; t < count; ++t) {
+            for (int c = 0; c < 3; ++c) vertexTriangles[fill[triangles[3 * t + c]]++] = (unsigned int) t;
+        }
+    }
+
+    std::vector<int> position(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    auto score = [&](size_t v) {
+        if (remaining[v] == 0) return -1.0f;
+        return (position[v] >= 0 ? cacheScore[position[v]] : 0.0f) +
+               valenceScore[std::min((int) remaining[v], maxValence)];
+    };
+    for (size_t v = 0; v < vertexCount; ++v) vertexScore[v] = score(v);
+
+    std::vector<float> triangleScore(count);
+    std::vector<char> emitted(count, 0);
+    for (size_t t = 0; t < count; ++t) {
+        triangleScore[t] = vertexScore[triangles[3 * t]] + vertexScore[triangles[3 * t + 1]] +
+                           vertexScore[triangles[3 * t + 2]];
+    }
+
+    std::vector<unsigned int> cache, next;
+    size_t best = (size_t)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+    size_t cursor = 0;
+    for (size_t k = 0; k < count; ++k) {
+
+        // Nothing cached touches a remaining triangle: take the next one in
+        // input order
+        if (best == count) {
+            while (emitted[cursor]) ++cursor;
+            best = cursor;
+        }
+
+        const unsigned int *tri = &triangles[3 * best];
+        std::copy(tri, tri + 3, &out[3 * k]);
+        emitted[best] = 1;
+        for (int c = 0; c < 3; ++c) {
+            unsigned int v = tri[c];
+            unsigned int *list = &vertexTriangles[offset[v]];
+            std::swap(*std::find(list, list + remaining[v], (unsigned int) best), list[remaining[v] - 1]);
+            remaining[v]--;
+        }
+
+        // The triangle's vertices move to the front of the cache
+        next.assign(tri, tri + 3);
+        for (size_t c = 0; c < cache.size(); ++c) {
+            if (cache[c] != tri[0] && cache[c] != tri[1] && cache[c] != tri[2]) next.push_back(cache[c]);
+        }
+        for (size_t c = 0; c < next.size(); ++c) {
+            position[next[c]] = c < (size_t) cacheSize ? (int) c : -1;
+            vertexScore[next[c]] = score(next[c]);
+        }
+
+        // Rescore the triangles around what was cached and pick the best
+        best = count;
+        float bestScore = -1.0f;
+        for (size_t c = 0; c < next.size(); ++c) {
+            unsigned int v = next[c];
+            for (unsigned int r = 0; r < remaining[v]; ++r) {
+                unsigned int t = vertexTriangles[offset[v] + r];
+                float s = vertexScore[triangles[3 * t]] + vertexScore[triangles[3 * t + 1]] +
+                          vertexScore[triangles[3 * t + 2]];
+                triangleScore[t] = s;
+                if (s > bestScore) {
+                    bestScore = s;
+                    best = t;
+                }
+            }
+        }
+        if (next.size() > (size_t) cacheSize) next.resize(cacheSize);
+        cache.swap(next);
+    }
+}
+
+// Post-transform cache behaviour of an index buffer on a FIFO cache of
+// cacheSize vertices. ACMR: vertex transforms per triangle (0.5 is the
+// limit for a large grid). ATVR: transforms per distinct vertex (1 is ideal).
+struct VertexCacheStats {
+    size_t triangles = 0;
+    size_t transforms = 0;
+    size_t vertices = 0;
+    double acmr = 0.0;
+    double atvr = 0.0;
+};
+
+inline VertexCacheStats simulateVertexCache(const std::vector<unsigned int> &indices, const GLenum mode,
+                                            const unsigned int restart, const size_t vertexCount,
+                                            const int cacheSize = vertexCacheSize) {
+    VertexCacheStats stats;
+
+    // A vertex is cached while fewer than cacheSize misses followed its own
+    std::vector<size_t> loaded(vertexCount, 0);     // misses up to and including its load; 0 never
+    size_t length = 0;
+    for (size_t k = 0; k < indices.size(); ++k) {
+        unsigned int v = indices[k];
+        if (mode == GL_TRIANGLE_STRIP && v == restart) {
+            length = 0;
+            continue;
+        }
+        if (loaded[v] == 0) stats.vertices++;
+        if (loaded[v] == 0 || stats.transforms - loaded[v] >= (size_t) cacheSize) {
+            stats.transforms++;
+            loaded[v] = stats.transforms;
+        }
+
+        ++length;
+        if (mode == GL_TRIANGLES) {
+            if (length % 3 == 0) stats.triangles++;
+        } else if (length >= 3) {
+            unsigned int a = indices[k - 2], b = indices[k - 1];
+            if (a != b && b != v && a != v) stats.triangles++;
+        }
+    }
+    stats.acmr = stats.triangles ? stats.transforms / (double) stats.triangles : 0.0;
+    stats.atvr = stats.vertices ? stats.transforms / (double) stats.vertices : 0.0;
+    return stats;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <OpenGP/GL/Application.h>
+#include "grid.h"
+#include "heightPyramid.h"
+#include "parallel.h"
+
+// Water drawn only where it can show. The sheet is the shared gridN x gridN
+// grid over gridSize world units, cut into tiles of tileQuads x tileQuads
+// quads. WaterCoverage is a CPU pass over the heights that keeps the lowest
+// terrain under every tile; WaterPatches draws the tiles whose ground dips
+// below the water level as instances of one patch, so the vertex and
+// fragment work follows the water's area instead of the map's.
+//
+// Tile (a, b) covers grid vertices i in [a * tileQuads, (a + 1) * tileQuads],
+// j likewise, at world x = -gridSize/2 + j/gridN * gridSize and y from i
+// (grid_vertex.glsl).
+
+struct WaterCoverage {
+    int tiles = 0;              // on a side
+    int tileQuads = 0;
+    float origin = 0.0f;        // world x and y of grid vertex (0, 0)
+    float tileSize = 0.0f;      // world units on a side of a tile
+    std::vector<float> lowest;  // [a + b * tiles]; -infinity where the tile reaches past the map
+
+    // Lowest terrain under the square [x, x + tileSize] x [y, y + tileSize]
+    // of the grid's tiles it overlaps; -infinity off the grid
+    float lowestUnder(const float x, const float y) const {
+        int b0 = (int) std::floor((x - origin) / tileSize), b1 = (int) std::ceil((x - origin) / tileSize + 1.0f) - 1;
+        int a0 = (int) std::floor((y - origin) / tileSize), a1 = (int) std::ceil((y - origin) / tileSize + 1.0f) - 1;
+        if (a0 < 0 || b0 < 0 || a1 >= tiles || b1 >= tiles) return -std::numeric_limits<float>::infinity();
+        float h = std::numeric_limits<float>::infinity();
+        for (int b = b0; b <= b1; ++b) {
+            for (int a = a0; a <= a1; ++a) {
+                h = std::min(h, lowest[a + b * tiles]);
+            }
+        }
+        return h;
+    }
+};
+
+// Tiles of the sheet against the terrain's samples: the lowest sample of
+// every cell a tile touches, which bounds the bilinear surface under it, and
+// of one more cell around so that the shader's wave offset may differ a little
+// from the one the tiles were picked for. Rows of tiles run on pool.
+inline WaterCoverage waterCoverage(const HeightPyramid &terrain, const int gridN, const float gridSize,
+                                   WorkerPool &pool, const int tileQuads = 32) {
+    WaterCoverage coverage;
+    coverage.tileQuads = tileQuads;
+    coverage.tiles = (gridN - 1 + tileQuads - 1) / tileQuads;
+    coverage.origin = -gridSize / 2;
+    coverage.tileSize = tileQuads * gridSize / gridN;
+    coverage.lowest.resize((size_t) coverage.tiles * coverage.tiles);
+
+    const float *heights = terrain.worldHeights();
+    const int tiles = coverage.tiles;
+    pool.parallelFor(tiles, [&](int rowBegin, int rowEnd) {
+        for (int b = rowBegin; b < rowEnd; ++b) {
+            for (int a = 0; a < tiles; ++a) {
+                float x = coverage.origin + b * coverage.tileSize, y = coverage.origin + a * coverage.tileSize;
+                int j0 = (int) std::floor((x - terrain.x0) / terrain.cellSize);
+                int j1 = (int) std::ceil((x + coverage.tileSize - terrain.x0) / terrain.cellSize);
+                int i0 = (int) std::floor((y - terrain.y0) / terrain.cellSize);
+                int i1 = (int) std::ceil((y + coverage.tileSize - terrain.y0) / terrain.cellSize);
+                float h = -std::numeric_limits<float>::infinity();
+                if (i0 >= 0 && j0 >= 0 && i1 < terrain.width && j1 < terrain.height) {
+                    i0 = std::max(i0 - 1, 0);
+                    j0 = std::max(j0 - 1, 0);
+                    i1 = std::min(i1 + 1, terrain.width - 1);
+                    j1 = std::min(j1 + 1, terrain.height - 1);
+                    h = std::numeric_limits<float>::infinity();
+                    for (int j = j0; j <= j1; ++j) {
+                        const float *row = heights + (size_t) j * terrain.width;
+                        h = std::min(h, *std::min_element(row + i0, row + i1 + 1));
+                    }
+                }
+                coverage.lowest[a + (size_t) b * tiles] = h;
+            }
+        }
+    }, 1);
+    return coverage;
+}
+
+// One surface's tiles, drawn with a shader built for GridVertexFormat::Instanced:
+// a patch of (tileQuads + 1)^2 vertices per instance, at the instance's
+// tile origin "vtile" = (i, j)
+class WaterPatches {
+public:
+
+    WaterPatches(const int gridN, const int tileQuads, const unsigned int restart)
+        : tileQuads(tileQuads), tiles((gridN - 1 + tileQuads - 1) / tileQuads), restart(restart) {
+        patch = patchIndexMesh(tileQuads + 1, tileQuads + 1, restart);
+    }
+
+    WaterPatches(const WaterPatches&) = delete;
+    WaterPatches &operator=(const WaterPatches&) = delete;
+
+    // Picks the tiles to draw for a sheet at height level moved by (dx, dy)
+    // world units: those over ground lower than level, or off the map. All
+    // of them without coverage. No GL calls unless the choice changed.
+    void select(const WaterCoverage *coverage, const float level, const float dx, const float dy) {
+        selection.clear();
+        for (int b = 0; b < tiles; ++b) {
+            for (int a = 0; a < tiles; ++a) {
+                if (coverage) {
+                    float x = coverage->origin + b * coverage->tileSize + dx;
+                    float y = coverage->origin + a * coverage->tileSize + dy;
+                    if (coverage->lowestUnder(x, y) >= level) continue;
+                }
+                selection.push_back(Vec2((float)(a * tileQuads), (float)(b * tileQuads)));
+            }
+        }
+        if (selection != uploaded) {
+            patch->set_vbo<Vec2>("vtile", selection, 1);
+            uploaded = selection;
+        }
+    }
+
+    void draw(Shader &shader) {
+        shader.set_uniform("tileVertices", tileQuads + 1);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(restart);
+        if (uploaded.empty()) return;
+        patch->set_attributes(shader);
+        patch->draw_instanced((GLsizei) uploaded.size());
+    }
+
+    size_t tilesDrawn() const { return uploaded.size(); }
+    size_t tileCount() const { return (size_t) tiles * tiles; }
+
+private:
+    const int tileQuads, tiles;
+    const unsigned int restart;
+    std::unique_ptr<GPUMesh> patch;
+    std::vector<Vec2> selection, uploaded;
+};
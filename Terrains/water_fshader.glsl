@@ -3,6 +3,7 @@ R"(
 
 // Uniforms
 uniform sampler2D noiseTex;
+uniform sampler2D normalTex;
 uniform sampler2D grass;
 uniform sampler2D rock;
 uniform sampler2D sand;
@@ -27,17 +28,15 @@ void main() {
     // Directional light source
     vec3 lightDir = normalize(vec3(1,1,1));
 
-    // Texture size in pixels
-    ivec2 size = textureSize(noiseTex, 0);
-
     /// TODO: Calculate surface normal N
-    /// HINT: Use textureOffset(,,) to read height at uv + pixelwise offset
-    /// HINT: Account for texture x,y dimensions in world space coordinates (default f_width=f_height=5)
-    vec3 A = vec3(uv.x + 1.0f / size.x, uv.y, textureOffset(noiseTex, uv, ivec2(1, 0)));
-    vec3 B = vec3(uv.x - 1.0f / size.x, uv.y, textureOffset(noiseTex, uv, ivec2(-1, 0)));
-    vec3 C = vec3(uv.x, uv.y-1.0f / size.y, textureOffset(noiseTex, uv, ivec2(0, -1)));
-    vec3 D = vec3(uv.x, uv.y+1.0f / size.y, textureOffset(noiseTex, uv, ivec2(0, 1)));
-    vec3 normal = normalize( cross(normalize(A-B), normalize(C-D)) );
+    // Precomputed normal: octahedral in normalTex, facing up; the lighting
+    // below expects it facing down
+    vec2 e = texture(normalTex, uv).rg;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    vec3 normal = -normalize(n);
 
     /// TODO: Texture according to height and slope
     /// HINT: Read noiseTex for height at uv
@@ -3,23 +3,26 @@ R"(
 uniform sampler2D noiseTex;
 uniform float waveMotion;
 
-in vec3 vposition;
-in vec2 vtexcoord;
-
+// Vertex position and uv come from gridPosition() and gridUV() (grid_vertex.glsl)
 
 uniform mat4 M;
 uniform mat4 V;
 uniform mat4 P;
+uniform float zOffset;      // height of this surface on the shared grid
 
 out vec2 uv;
 out vec3 fragPos;
 
 out float waterHeight;
 
+// How far the wave moves the sheet
+vec3 waveOffset() {
+    return vec3(cos(2.0 * 3.14/waveMotion), 0.0, 0.0);
+}
 
 void main() {
 
-    uv = vtexcoord;
+    uv = gridUV();
 
     // Earth scene
     float water = 0.2f;
@@ -27,8 +30,9 @@ void main() {
     
     // TODO: Calculate height
 
-    vec3 vtx=vposition.xyz;
-    vtx.x = vtx.x +(cos(2.0 * 3.14/waveMotion));
+    vec3 vtx=gridPosition();
+    vtx.z += zOffset;
+    vtx += waveOffset();
 
 
     // Set gl_Position
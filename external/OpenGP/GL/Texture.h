@@ -77,7 +77,7 @@ public:
     GenericTexture &operator=(const GenericTexture&) = delete;
 
     virtual ~GenericTexture() {
-        glGenTextures(1, &_id);
+        glDeleteTextures(1, &_id);
     }
 
     void bind() const { glBindTexture(GL_TEXTURE_2D, _id); }